@@ -1,5 +1,6 @@
 import axios from 'axios';
 import {sleep} from '../utils';
+import MlsGenInterface from '../tasks/impulse-response/mlsGen/mlsGenInterface';
 /**
  *
  */
@@ -13,6 +14,84 @@ class PythonServerAPI {
   MAX_RETRY_COUNT = 3;
   /** @private */
   RETRY_DELAY_MS = 1000;
+
+  /**
+   * Whether a task's recordings are at its sampleRate already. With a downsample factor above 1
+   * the server decides how the recordings relate to sampleRate, so those stay on the server.
+   *
+   * @private
+   * @example
+   */
+  static #atSampleRate = downsample =>
+    downsample === undefined || downsample === null || Number(downsample) === 1;
+
+  /**
+   * Tasks the WASM module can compute whose results have not been checked against the server's
+   * yet, so the server stays the default: set an entry to true to compute that task locally.
+   * psd covers the psd, background-psd, subtracted-psd and mls-psd tasks; frequencyResponse the
+   * frequency-response and frequency-response-to-impulse-response tasks, whose duration arguments
+   * the module does not use. volume measures the 1 kHz level and THD with the module's own
+   * Goertzel/Hann analysis, whose outDbSPL, outDbSPL1000 and THD have not been compared with the
+   * volume task's for the same recording. volumeParameters fits the module's own soft-knee model,
+   * whose gainDBSPL is the level of a 0 dB tone (not the server's convention) and which leaves out
+   * lCalib and componentGainDBSPL: its parameters must not be stored alongside the server's.
+   * inverseFilter designs the system and component inverse filters with the module's own
+   * regularization and peak shift, so its filters and attenuatorGain_dB are not the server's.
+   * convolution plays the MLS through the inverse filters and irConvolution the test signal through
+   * the loudspeaker and microphone IRs on the module's partitioned convolver, whose output (edges,
+   * settling, level) has not been compared with the convolution and ir-convolution tasks.
+   * impulseResponse lets ImpulseResponse deconvolve each capture with its own MLSGen (onset
+   * detection, drift correction and median rejection of outlier periods) instead of the
+   * impulse-response task, whose IRs it has not been compared with.
+   */
+  static LOCAL_TASKS = {
+    impulseResponse: false,
+    psd: false,
+    frequencyResponse: false,
+    volume: false,
+    volumeParameters: false,
+    inverseFilter: false,
+    convolution: false,
+    irConvolution: false,
+  };
+
+  /**
+   * Run a task in the WASM module instead of on the server, saving the round trip.
+   *
+   * @private
+   * @param compute - async function returning the task's answer, or null when it cannot
+   * @param optIn - key of LOCAL_TASKS the task needs turned on, if any
+   * @returns the answer, or null to fall back to the server (also when the module fails to load)
+   * @example
+   */
+  static #computeLocally = async (compute, optIn = null) => {
+    if (optIn !== null && PythonServerAPI.LOCAL_TASKS[optIn] !== true) return null;
+    try {
+      return await compute();
+    } catch (error) {
+      console.warn('computing locally failed, falling back to the server', error);
+      return null;
+    }
+  };
+
+  /**
+   * Fields of the inverse impulse response tasks shared by the system and component filters, from
+   * MlsGenInterface.getInverseFilter.
+   *
+   * @private
+   * @example
+   */
+  static #inverseFilterResponse = filter => {
+    return {
+      iir: Array.from(filter.iir),
+      iirNoBandpass: Array.from(filter.iirNoBandpass),
+      ir: Array.from(filter.gains),
+      frequencies: Array.from(filter.frequencies),
+      attenuatorGain_dB: filter.attenuatorGainDb,
+      fMaxHz: filter.fMaxHz,
+    };
+  };
+
   /**
    * @param data- -
    * g = inverted impulse response, when convolved with the impulse
@@ -89,6 +168,16 @@ class PythonServerAPI {
     return res.data[task];
   };
 
+  /**
+   * Free what the WASM module keeps cached for the tasks it computes locally, once a calibration
+   * is over.
+   *
+   * @example
+   */
+  releaseLocalCaches = async () => {
+    await PythonServerAPI.#computeLocally(() => MlsGenInterface.releaseModuleCaches());
+  };
+
   getConvolution = async ({
     mls,
     inverse_response,
@@ -96,6 +185,18 @@ class PythonServerAPI {
     attenuatorGain_dB,
     mls_amplitude,
   }) => {
+    const local = await PythonServerAPI.#computeLocally(() =>
+      MlsGenInterface.getConvolution({
+        mls,
+        inverseResponse: inverse_response,
+        inverseResponseNoBandpass: inverse_response_no_bandpass,
+        amplitude: mls_amplitude,
+        attenuatorGainDb: attenuatorGain_dB,
+      }),
+      'convolution'
+    );
+    if (local !== null) return local;
+
     const task = 'convolution';
     let res = null;
 
@@ -135,6 +236,18 @@ class PythonServerAPI {
     totalDuration,
     totalDuration1000Hz,
   }) => {
+    const local = await PythonServerAPI.#computeLocally(() =>
+      MlsGenInterface.getImpulseResponseFromFrequencyResponse({
+        frequencies,
+        gains,
+        sample_rate,
+        iir_length,
+        calibrateSoundIIRPhase,
+      }),
+      'frequencyResponse'
+    );
+    if (local !== null) return local;
+
     const task = 'frequency-response-to-impulse-response';
     let res = null;
 
@@ -175,6 +288,16 @@ class PythonServerAPI {
     totalDuration,
     totalDuration1000Hz,
   }) => {
+    const local = await PythonServerAPI.#computeLocally(() =>
+      MlsGenInterface.getFrequencyResponseFromImpulseResponse({
+        impulseResponse,
+        sampleRate,
+        timeArray,
+      }),
+      'frequencyResponse'
+    );
+    if (local !== null) return local;
+
     const task = 'frequency-response';
     let res = null;
 
@@ -336,6 +459,15 @@ class PythonServerAPI {
   };
 
   getPSD = async ({unconv_rec, conv_rec, sampleRate, downsample}) => {
+    const local = await PythonServerAPI.#computeLocally(async () => {
+      if (!PythonServerAPI.#atSampleRate(downsample)) return null;
+      const unconv = await MlsGenInterface.getPowerSpectralDensity({signal: unconv_rec, sampleRate});
+      const conv = await MlsGenInterface.getPowerSpectralDensity({signal: conv_rec, sampleRate});
+      if (unconv === null || conv === null) return null;
+      return {x_unconv: unconv.x, y_unconv: unconv.y, x_conv: conv.x, y_conv: conv.y};
+    }, 'psd');
+    if (local !== null) return local;
+
     const task = 'psd';
     let res = null;
 
@@ -366,6 +498,15 @@ class PythonServerAPI {
   };
 
   getBackgroundNoisePSD = async ({background_rec, sampleRate}) => {
+    const local = await PythonServerAPI.#computeLocally(async () => {
+      const psd = await MlsGenInterface.getPowerSpectralDensity({
+        signal: background_rec,
+        sampleRate,
+      });
+      return psd === null ? null : {x_background: psd.x, y_background: psd.y};
+    }, 'psd');
+    if (local !== null) return local;
+
     const task = 'background-psd';
     let res = null;
 
@@ -417,6 +558,17 @@ class PythonServerAPI {
   };
 
   getSubtractedPSD = async (rec, knownGains, knownFrequencies, sampleRate, downsample) => {
+    const local = await PythonServerAPI.#computeLocally(async () => {
+      if (!PythonServerAPI.#atSampleRate(downsample)) return null;
+      return MlsGenInterface.getPowerSpectralDensity({
+        signal: rec,
+        sampleRate,
+        knownFrequencies,
+        knownGains,
+      });
+    }, 'psd');
+    if (local !== null) return local;
+
     const task = 'subtracted-psd';
     let res = null;
 
@@ -516,6 +668,42 @@ class PythonServerAPI {
     calibrateSoundIIRPhase,
     downsample,
   }) => {
+    const local = await PythonServerAPI.#computeLocally(async () => {
+      if (!PythonServerAPI.#atSampleRate(downsample)) return null;
+      const filter = await MlsGenInterface.getInverseFilter({
+        impulseResponses: payload,
+        sampleRate,
+        lowHz,
+        highHz,
+        iirLength,
+        calibrateSoundIIRPhase,
+        maxBoostDb: calibrateSoundBurstFilteredExtraDb,
+        knownFrequencies: componentIRFreqs,
+        knownGains: componentIRGains,
+        smoothOctaves: calibrateSoundSmoothOctaves,
+        smoothMinBandwidthHz: calibrateSoundSmoothMinBandwidthHz,
+      });
+      if (filter === null) return null;
+      const gains = Array.from(filter.gains);
+      const irTime = await MlsGenInterface.getImpulseResponseFromFrequencyResponse({
+        frequencies: filter.frequencies,
+        gains: filter.gains,
+        sample_rate: sampleRate,
+        iir_length: irLength,
+        calibrateSoundIIRPhase: 'minimum',
+      });
+      return {
+        ...PythonServerAPI.#inverseFilterResponse(filter),
+        ir: gains,
+        irOrigin: Array.from(filter.gainsOrigin),
+        irTime: irTime.impulse_response,
+        // the measured phase less the (minimum) phase of the microphone's gains
+        component_angle: Array.from(filter.componentAngles),
+        system_angle: Array.from(filter.angles),
+      };
+    }, 'inverseFilter');
+    if (local !== null) return local;
+
     const task = 'component-inverse-impulse-response';
     let res = null;
 
@@ -568,6 +756,21 @@ class PythonServerAPI {
     calibrateSoundIIRPhase,
     downsample,
   }) => {
+    const local = await PythonServerAPI.#computeLocally(async () => {
+      if (!PythonServerAPI.#atSampleRate(downsample)) return null;
+      const filter = await MlsGenInterface.getInverseFilter({
+        impulseResponses: payload,
+        sampleRate,
+        lowHz,
+        highHz,
+        iirLength,
+        calibrateSoundIIRPhase,
+        maxBoostDb: calibrateSoundBurstFilteredExtraDb,
+      });
+      return filter === null ? null : PythonServerAPI.#inverseFilterResponse(filter);
+    }, 'inverseFilter');
+    if (local !== null) return local;
+
     const task = 'system-inverse-impulse-response';
     let res = null;
 
@@ -605,6 +808,13 @@ class PythonServerAPI {
   };
 
   getMLSPSD = async ({mls, sampleRate, downsample}) => {
+    const local = await PythonServerAPI.#computeLocally(async () => {
+      if (!PythonServerAPI.#atSampleRate(downsample)) return null;
+      const psd = await MlsGenInterface.getPowerSpectralDensity({signal: mls, sampleRate});
+      return psd === null ? null : {x_mls: psd.x, y_mls: psd.y};
+    }, 'psd');
+    if (local !== null) return local;
+
     const task = 'mls-psd';
     let res = null;
 
@@ -764,6 +974,12 @@ class PythonServerAPI {
   };
 
   getVolumeCalibration = async ({payload, sampleRate, lCalib}) => {
+    const local = await PythonServerAPI.#computeLocally(
+      () => MlsGenInterface.getVolume({signal: payload, sampleRate, lCalib}),
+      'volume'
+    );
+    if (local !== null) return local;
+
     const task = 'volume';
     let res = null;
 
@@ -817,6 +1033,12 @@ class PythonServerAPI {
     lCalib,
     componentGainDBSPL,
   }) => {
+    const local = await PythonServerAPI.#computeLocally(
+      () => MlsGenInterface.getVolumeParameters({inDBValues, outDBSPLValues}),
+      'volumeParameters'
+    );
+    if (local !== null) return local;
+
     const task = 'volume-parameters';
     let res = null;
 
@@ -859,6 +1081,16 @@ class PythonServerAPI {
   };
 
   irConvolution = async ({input_signal, microphone_ir, loudspeaker_ir, duration, sample_rate}) => {
+    const local = await PythonServerAPI.#computeLocally(async () => {
+      const output = await MlsGenInterface.getChainConvolution({
+        signal: input_signal,
+        impulseResponses: [loudspeaker_ir, microphone_ir],
+        length: Math.round(duration * sample_rate),
+      });
+      return output === null ? null : {output_signal: Array.from(output)};
+    }, 'irConvolution');
+    if (local !== null) return local;
+
     const task = 'ir-convolution';
     let res = null;
 
@@ -3949,6 +3949,7 @@ class Combination extends AudioCalibrator {
       console.log(timeStampresult);
 
       this.stopCalibrationAudio();
+      await this.pyServerAPI.releaseLocalCaches();
 
       resolve(total_results);
     });
@@ -1,4 +1,5 @@
 import AudioCalibrator from '../audioCalibrator';
+import PythonServerAPI from '../../server/PythonServerAPI';
 import MlsGenInterface from './mlsGen/mlsGenInterface';
 
 import {sleep, csvToArray, saveToCSV} from '../../utils';
@@ -78,6 +79,9 @@ class ImpulseResponse extends AudioCalibrator {
   /** @private */
   TAPER_SECS = 5;
 
+  /** @private */
+  REJECT_THRESHOLD = 3;
+
   /** @private */
   offsetGainNode;
 
@@ -152,6 +156,33 @@ class ImpulseResponse extends AudioCalibrator {
       });
   };
 
+  /**
+   * Deconvolve a capture with the MLSGen of this calibration instead of the server, when
+   * PythonServerAPI.LOCAL_TASKS.impulseResponse is on: the onset of the first period is found and
+   * the clock drift corrected in WASM, then the periods are averaged, dropping those further than
+   * REJECT_THRESHOLD times the median distance from the mean.
+   *
+   * @private
+   * @param payload - the recorded samples
+   * @returns the impulse response (P + 1 samples), or null to ask the server.
+   * @example
+   */
+  #computeImpulseResponseLocally = payload => {
+    if (PythonServerAPI.LOCAL_TASKS.impulseResponse !== true) return null;
+    try {
+      const kept = this.#mlsGenInterface.setRecordedSignalsDriftCorrected(
+        payload,
+        this.numMLSPerCapture,
+        this.REJECT_THRESHOLD
+      );
+      if (kept < 1) return null;
+      return Array.from(this.#mlsGenInterface.getImpulseResponse());
+    } catch (error) {
+      console.warn('computing the IR locally failed, falling back to the server', error);
+      return null;
+    }
+  };
+
   /** .
    * .
    * .
@@ -171,14 +202,17 @@ class ImpulseResponse extends AudioCalibrator {
     this.status =
       `computing the IR of the last recording...`.toString() + this.generateTemplate().toString();
     this.emit('update', {message: this.status});
+    const local = this.#computeImpulseResponseLocally(payload);
     this.impulseResponses.push(
-      this.pyServerAPI
-        .getImpulseResponse({
-          sampleRate: this.sourceSamplingRate || 96000,
-          payload,
-          mls,
-          P: this.#P,
-        })
+      (local !== null
+        ? Promise.resolve(local)
+        : this.pyServerAPI.getImpulseResponse({
+            sampleRate: this.sourceSamplingRate || 96000,
+            payload,
+            mls,
+            P: this.#P,
+          })
+      )
         .then(res => {
           if (this.numSuccessfulCaptured < this.numCaptures) {
             this.numSuccessfulCaptured += 1;
@@ -457,8 +491,8 @@ class ImpulseResponse extends AudioCalibrator {
 
     await MlsGenInterface.factory(
       this.#mlsOrder,
-      this.sinkSamplingRate,
-      this.sourceSamplingRate
+      this.sourceSamplingRate,
+      this.sinkSamplingRate
     ).then(mlsGenInterface => {
       this.#mlsGenInterface = mlsGenInterface;
       this.#mlsBufferView = this.#mlsGenInterface.getMLS();
@@ -521,8 +555,8 @@ class ImpulseResponse extends AudioCalibrator {
     // initialize the MLSGenInterface object with it's factory method
     await MlsGenInterface.factory(
       this.#mlsOrder,
-      this.sinkSamplingRate,
-      this.sourceSamplingRate
+      this.sourceSamplingRate,
+      this.sinkSamplingRate
     ).then(mlsGenInterface => {
       this.#mlsGenInterface = mlsGenInterface;
       this.#mlsBufferView = this.#mlsGenInterface.getMLS();
@@ -580,6 +614,9 @@ class ImpulseResponse extends AudioCalibrator {
         console.error(err);
       });
 
+    // the calibration is over: free the plans and buffers kept for the next engine
+    this.#mlsGenInterface.releaseCachedPlans();
+
     let iir_and_plots = {
       iir: this.invertedImpulseResponse,
       x_unconv: results['x_unconv'],
@@ -0,0 +1,160 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_AVERAGING_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_AVERAGING_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include "simd.hpp"
+
+/**
+ * @brief acc[i] += x[i] for n samples.
+ */
+inline void accumulateSignal(float *acc, const float *x, long n) {
+  typedef Vec<float> V;
+  long i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(acc + i, V::add(V::load(acc + i), V::load(x + i)));
+  }
+  for (; i < n; i++) acc[i] += x[i];
+}
+
+/**
+ * @brief x[i] *= gain for n samples.
+ */
+inline void scaleSignal(float *x, long n, float gain) {
+  typedef Vec<float> V;
+  const typename V::type g = V::splat(gain);
+  long i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(x + i, V::mul(V::load(x + i), g));
+  }
+  for (; i < n; i++) x[i] *= gain;
+}
+
+/**
+ * @brief Sum of squared differences between x and reference over n samples.
+ */
+inline double squaredDistance(const float *x, const float *reference, long n) {
+  double sum = 0;
+  for (long i = 0; i < n; i++) {
+    const double d = x[i] - reference[i];
+    sum += d * d;
+  }
+  return sum;
+}
+
+/**
+ * @brief Period-synchronous average of a capture holding consecutive periods
+ * of P samples. With a positive rejectThreshold, a period whose squared
+ * distance to the mean of all periods exceeds rejectThreshold times the
+ * median distance is treated as an outlier (a door slam, a cough) and left
+ * out of a second averaging pass.
+ *
+ * @param capture - numPeriods * P samples
+ * @param P - period length
+ * @param numPeriods - number of periods in the capture
+ * @param rejectThreshold - outlier threshold, <= 0 to keep every period
+ * @param out - P samples, the averaged period
+ * @return long - number of periods kept in the average
+ */
+inline long averagePeriods(const float *capture, long P, long numPeriods,
+                           double rejectThreshold, float *out) {
+  long k, kept = numPeriods;
+  std::fill(out, out + P, 0.0f);
+  if (numPeriods <= 0) return 0;
+  for (k = 0; k < numPeriods; k++) accumulateSignal(out, capture + k * P, P);
+  scaleSignal(out, P, 1.0f / numPeriods);
+  if (rejectThreshold <= 0 || numPeriods < 3) return kept;
+
+  double *distance = new double[numPeriods];
+  double *sorted = new double[numPeriods];
+  for (k = 0; k < numPeriods; k++) {
+    distance[k] = sorted[k] = squaredDistance(capture + k * P, out, P);
+  }
+  std::nth_element(sorted, sorted + numPeriods / 2, sorted + numPeriods);
+  const double limit = rejectThreshold * sorted[numPeriods / 2];
+  kept = 0;
+  for (k = 0; k < numPeriods; k++) {
+    if (distance[k] <= limit) kept++;
+  }
+  if (kept == 0) {
+    kept = numPeriods;  // threshold below 1, nothing to single out
+  } else if (kept < numPeriods) {
+    std::fill(out, out + P, 0.0f);
+    for (k = 0; k < numPeriods; k++) {
+      if (distance[k] <= limit) accumulateSignal(out, capture + k * P, P);
+    }
+    scaleSignal(out, P, 1.0f / kept);
+  }
+  delete[] distance;
+  delete[] sorted;
+  return kept;
+}
+
+/**
+ * @brief Running period-synchronous sum of a stream of samples that arrives
+ * in blocks of any size, holding a single period in memory.
+ *
+ * Sample t of the stream is added to slot t mod P. The average is taken per
+ * slot over the periods that have covered it so far, so it is exact after
+ * every completed period and a valid running estimate in between.
+ */
+class PeriodAccumulator {
+ public:
+  explicit PeriodAccumulator(long P)
+      : P(P), sum(P, 0.0f), phase(0), count(0) {}
+
+  /**
+   * @brief Forget every sample pushed so far.
+   */
+  void reset() {
+    std::fill(sum.begin(), sum.end(), 0.0f);
+    phase = 0;
+    count = 0;
+  }
+
+  /**
+   * @brief Add n samples of the stream.
+   *
+   * @return long - number of periods completed by this block
+   */
+  long push(const float *block, long n) {
+    const long before = count;
+    while (n > 0) {
+      const long run = std::min(n, P - phase);
+      accumulateSignal(sum.data() + phase, block, run);
+      block += run;
+      n -= run;
+      phase += run;
+      if (phase == P) {
+        phase = 0;
+        count++;
+      }
+    }
+    return count - before;
+  }
+
+  /**
+   * @brief Number of complete periods pushed.
+   */
+  long periods() const { return count; }
+
+  /**
+   * @brief Running average, P samples (zero where nothing was pushed yet).
+   */
+  void average(float *out) const {
+    const float full = count > 0 ? 1.0f / count : 0.0f;
+    const float partial = 1.0f / (count + 1);
+    long i;
+    for (i = 0; i < phase; i++) out[i] = sum[i] * partial;
+    for (; i < P; i++) out[i] = sum[i] * full;
+  }
+
+ private:
+  long P;
+  std::vector<float> sum;  // per slot sum of the samples pushed
+  long phase;              // slot of the next sample
+  long count;              // complete periods
+};
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_AVERAGING_HPP_
@@ -0,0 +1,343 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_CONVOLUTION_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_CONVOLUTION_HPP_
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "correlation.hpp"
+#include "simd.hpp"
+
+// Default block of the partitioned convolution: 1024 samples, 21 ms at 48 kHz
+const long kDefaultConvolutionBlock = 1024;
+
+// Largest block of a non-uniform partitioning; longer filters add partitions
+const long kMaxConvolutionBlock = 1L << 16;
+
+/**
+ * @brief Partitions per block size of a non-uniform partitioning before the
+ * block doubles (each level also starts late enough to be computed in time).
+ */
+const long kPartitionsPerLevel = 4;
+
+/**
+ * @brief One uniformly partitioned overlap-save convolution: the filter cut
+ * into partitions of `block` samples, each transformed once on 2 * block
+ * points, and a frequency-domain delay line holding the spectra of the last
+ * `partitions` input blocks. Every input block costs one forward and one
+ * inverse FFT, whatever the filter length; the partitions are a complex
+ * multiply-accumulate over the delay line.
+ *
+ * Spectra are kept with real and imaginary parts in separate arrays, padded
+ * to the SIMD width, so the multiply-accumulate is plain Vec arithmetic.
+ */
+class UniformConvolver {
+ public:
+  const long block;
+  const long partitions;
+
+  /**
+   * @param h - the partitions * block samples of filter this level covers
+   * (shorter is zero padded)
+   * @param length - samples of h
+   * @param block - samples per partition and per input block
+   */
+  UniformConvolver(const float *h, long length, long block)
+      : block(block),
+        partitions(std::max(1L, (length + block - 1) / block)),
+        bins(block + 1),
+        stride((block + 1 + kPad - 1) / kPad * kPad),
+        fft(RealFftPlan::get(2 * block)),
+        Hre(partitions * stride, 0.0f),
+        Him(partitions * stride, 0.0f),
+        Xre(partitions * stride, 0.0f),
+        Xim(partitions * stride, 0.0f),
+        Yre(stride),
+        Yim(stride),
+        window(2 * block, 0.0f),
+        time(2 * block),
+        spectrum(bins),
+        slot(0) {
+    // the 1 / (2 * block) of the inverse transform is folded into the filter
+    const float scale = 1.0f / (2 * block);
+    for (long q = 0; q < partitions; q++) {
+      const long count = std::min(block, length - q * block);
+      std::fill(time.begin(), time.end(), 0.0f);
+      for (long i = 0; i < count; i++) time[i] = h[q * block + i] * scale;
+      fft->forward(time.data(), spectrum.data());
+      split(spectrum.data(), &Hre[q * stride], &Him[q * stride]);
+    }
+  }
+
+  /**
+   * @brief Filter the next block input samples into block output samples.
+   */
+  void process(const float *in, float *out) {
+    long k;
+    memcpy(&window[block], in, block * sizeof(float));
+    fft->forward(window.data(), spectrum.data());
+    split(spectrum.data(), &Xre[slot * stride], &Xim[slot * stride]);
+    std::fill(Yre.begin(), Yre.end(), 0.0f);
+    std::fill(Yim.begin(), Yim.end(), 0.0f);
+    for (long q = 0; q < partitions; q++) {
+      const long x = (slot - q + partitions) % partitions;
+      multiplyAccumulate(&Xre[x * stride], &Xim[x * stride], &Hre[q * stride],
+                         &Him[q * stride], Yre.data(), Yim.data(), stride);
+    }
+    for (k = 0; k < bins; k++) {
+      spectrum[k].r = Yre[k];
+      spectrum[k].i = Yim[k];
+    }
+    fft->inverse(spectrum.data(), time.data());
+    // the second half is free of the circular wrap-around
+    memcpy(out, &time[block], block * sizeof(float));
+    memmove(window.data(), &window[block], block * sizeof(float));
+    slot = (slot + 1) % partitions;
+  }
+
+  /**
+   * @brief Forget the input, as if the filter had only heard silence.
+   */
+  void reset() {
+    std::fill(Xre.begin(), Xre.end(), 0.0f);
+    std::fill(Xim.begin(), Xim.end(), 0.0f);
+    std::fill(window.begin(), window.end(), 0.0f);
+    slot = 0;
+  }
+
+  /**
+   * @brief y += x * h over n complex values in split form.
+   */
+  static void multiplyAccumulate(const float *xr, const float *xi,
+                                 const float *hr, const float *hi, float *yr,
+                                 float *yi, long n) {
+    typedef Vec<float> V;
+    long k = 0;
+    for (; k + V::width <= n; k += V::width) {
+      const typename V::type ar = V::load(xr + k), ai = V::load(xi + k);
+      const typename V::type br = V::load(hr + k), bi = V::load(hi + k);
+      V::store(yr + k, V::add(V::load(yr + k),
+                              V::sub(V::mul(ar, br), V::mul(ai, bi))));
+      V::store(yi + k, V::add(V::load(yi + k),
+                              V::add(V::mul(ar, bi), V::mul(ai, br))));
+    }
+    for (; k < n; k++) {
+      yr[k] += xr[k] * hr[k] - xi[k] * hi[k];
+      yi[k] += xr[k] * hi[k] + xi[k] * hr[k];
+    }
+  }
+
+ private:
+  static const long kPad = 8;  // spectra padded to a multiple of any width
+
+  const long bins;
+  const long stride;
+  const std::shared_ptr<const RealFftPlan> fft;
+  std::vector<float> Hre, Him;  // filter partitions, stride apart
+  std::vector<float> Xre, Xim;  // delay line of input spectra, by slot
+  std::vector<float> Yre, Yim;  // accumulated output spectrum
+  std::vector<float> window;    // previous and current input block
+  std::vector<float> time;
+  std::vector<kiss_fft_cpx> spectrum;
+  long slot;  // delay line slot of the newest input block
+
+  void split(const kiss_fft_cpx *X, float *re, float *im) const {
+    for (long k = 0; k < bins; k++) {
+      re[k] = X[k].r;
+      im[k] = X[k].i;
+    }
+  }
+};
+
+/**
+ * @brief Streaming convolution with a filter of any length, by overlap-save
+ * on partitions: uniform (every partition `block` samples) or non-uniform,
+ * where the head of the filter uses `block` sample partitions and later parts
+ * use partitions that double every kPartitionsPerLevel up to
+ * kMaxConvolutionBlock. Each part is a UniformConvolver that runs every time
+ * its own block fills and is delayed by its offset in the filter; a part of
+ * block B_k starting at o_k >= B_k - block is always ready in time, so the
+ * output is exact with no latency beyond the block.
+ *
+ * Non-uniform partitioning keeps the per-block cost of long filters down: the
+ * transforms are larger but run less often, and there are far fewer
+ * partitions to multiply-accumulate.
+ */
+class PartitionedConvolver {
+ public:
+  /**
+   * @param h - length samples of filter, at least 1
+   * @param length - samples of h
+   * @param block - samples per call of process (a power of two)
+   * @param nonUniform - grow the partitions along the filter
+   */
+  PartitionedConvolver(const float *h, long length, long block,
+                       bool nonUniform)
+      : block(block), now(0) {
+    long offset = 0, levelBlock = block;
+    while (offset < length) {
+      const long rest = length - offset;
+      long span = rest;
+      if (nonUniform && levelBlock < kMaxConvolutionBlock &&
+          rest > 2 * kPartitionsPerLevel * levelBlock) {
+        span = kPartitionsPerLevel * levelBlock;
+      }
+      levels.push_back({offset, 0, std::unique_ptr<UniformConvolver>(
+                                       new UniformConvolver(h + offset, span,
+                                                            levelBlock)),
+                        std::vector<float>(levelBlock),
+                        std::vector<float>(levelBlock)});
+      offset += span;
+      if (nonUniform && levelBlock < kMaxConvolutionBlock) levelBlock *= 2;
+    }
+    ringMask = nextPowerOfTwo(offset + 2 * block) - 1;
+    ring.assign(ringMask + 1, 0.0f);
+  }
+
+  long getBlockSize() const { return block; }
+  long getLevels() const { return (long)levels.size(); }
+
+  /**
+   * @brief Filter the next block input samples into block output samples:
+   * out[i] = sum over m of h[m] * x[now + i - m].
+   */
+  void process(const float *in, float *out) {
+    for (Level &level : levels) {
+      const long levelBlock = level.convolver->block;
+      memcpy(&level.input[level.filled], in, block * sizeof(float));
+      level.filled += block;
+      if (level.filled < levelBlock) continue;
+      level.convolver->process(level.input.data(), level.output.data());
+      level.filled = 0;
+      // the output of the input block that just filled, offset along h
+      const long start = now + block - levelBlock + level.offset;
+      for (long i = 0; i < levelBlock; i++) {
+        ring[(start + i) & ringMask] += level.output[i];
+      }
+    }
+    for (long i = 0; i < block; i++) {
+      float &sample = ring[(now + i) & ringMask];
+      out[i] = sample;
+      sample = 0;
+    }
+    now += block;
+  }
+
+  /**
+   * @brief Start again from silence.
+   */
+  void reset() {
+    for (Level &level : levels) {
+      level.convolver->reset();
+      level.filled = 0;
+    }
+    std::fill(ring.begin(), ring.end(), 0.0f);
+    now = 0;
+  }
+
+ private:
+  struct Level {
+    long offset;  // first sample of h this level convolves with
+    long filled;  // input samples waiting for the level's block
+    std::unique_ptr<UniformConvolver> convolver;
+    std::vector<float> input;
+    std::vector<float> output;
+  };
+
+  const long block;
+  std::vector<Level> levels;
+  std::vector<float> ring;  // output being summed, indexed by time & mask
+  long ringMask;
+  long now;  // samples processed
+};
+
+/**
+ * @brief Whether to partition a filter of length samples non-uniformly for
+ * blocks of block samples: when it spans many blocks.
+ */
+inline bool preferNonUniform(long length, long block) {
+  return length > 4 * kPartitionsPerLevel * block;
+}
+
+/**
+ * @brief A looped signal played through a filter, block by block, the way a
+ * looping AudioBufferSourceNode plays it through the filter: each call of
+ * next gives the following block of output, so playback can start on the
+ * first blocks while the rest are still being computed.
+ */
+class LoopedConvolution {
+ public:
+  /**
+   * @param x - period samples, repeated (copied)
+   * @param period - length of x, at least 1
+   * @param h - length samples of filter, at least 1
+   * @param length - samples of h
+   * @param gain - applied to every output sample
+   * @param steadyState - skip the first length - 1 samples of build-up, so
+   * one period of output is the circular convolution of x and h
+   * @param block - samples per block (a power of two)
+   */
+  LoopedConvolution(const float *x, long period, const float *h, long length,
+                    float gain, bool steadyState, long block)
+      : signal(x, x + period),
+        convolver(h, length, block, preferNonUniform(length, block)),
+        gain(gain),
+        in(block),
+        out(block),
+        position(0),
+        cursor(block) {
+    long skip = steadyState ? length - 1 : 0;
+    // start length - 1 samples before the period for the steady state
+    position = (period - skip % period) % period;
+    for (; skip >= block; skip -= block) advance();
+    advance();
+    cursor = skip;
+  }
+
+  long getBlockSize() const { return convolver.getBlockSize(); }
+
+  /**
+   * @brief Write the next n samples of output.
+   */
+  void next(float *y, long n) {
+    const long block = convolver.getBlockSize();
+    for (long i = 0; i < n; i++) {
+      if (cursor == block) {
+        advance();
+        cursor = 0;
+      }
+      y[i] = out[cursor++] * gain;
+    }
+  }
+
+ private:
+  std::vector<float> signal;
+  PartitionedConvolver convolver;
+  float gain;
+  std::vector<float> in, out;
+  long position;  // next sample of signal to filter
+  long cursor;    // next sample of out to hand out
+
+  void advance() {
+    const long period = (long)signal.size();
+    for (long i = 0; i < (long)in.size(); i++) {
+      in[i] = signal[position];
+      if (++position == period) position = 0;
+    }
+    convolver.process(in.data(), out.data());
+  }
+};
+
+/**
+ * @brief n samples of a looped signal through a filter (see
+ * LoopedConvolution), all at once.
+ */
+inline void convolveLooped(const float *x, long period, const float *h,
+                           long length, float gain, bool steadyState,
+                           float *y, long n, long block) {
+  LoopedConvolution(x, period, h, length, gain, steadyState, block).next(y, n);
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_CONVOLUTION_HPP_
@@ -0,0 +1,283 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_CORRELATION_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_CORRELATION_HPP_
+
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "kiss_fft.h"
+#include "kiss_fftr.h"
+#include "resampler.hpp"
+
+/**
+ * @brief Smallest power of two >= n.
+ */
+inline long nextPowerOfTwo(long n) {
+  long size = 1;
+  while (size < n) size <<= 1;
+  return size;
+}
+
+/**
+ * @brief Forward and inverse real-input kissfft plans of one power-of-two
+ * size. Like MLSPlan, plans are cached per size and shared; kissfft keeps
+ * scratch inside a plan, so transforms on a shared plan are serialized.
+ */
+class RealFftPlan {
+ public:
+  const long nfft;
+
+  /**
+   * @brief Get the plan for nfft points from the module-wide cache, building
+   * it on first use.
+   */
+  static std::shared_ptr<const RealFftPlan> get(long nfft);
+
+  /**
+   * @brief Drop the cached plans nothing is using anymore.
+   *
+   * @return long - number of plans released
+   */
+  static long releaseUnused();
+
+  /**
+   * @brief nfft real samples to nfft / 2 + 1 complex bins.
+   */
+  void forward(const float *in, kiss_fft_cpx *out) const;
+
+  /**
+   * @brief nfft / 2 + 1 complex bins to nfft real samples (unnormalized:
+   * inverse(forward(x)) = nfft * x).
+   */
+  void inverse(const kiss_fft_cpx *in, float *out) const;
+
+  explicit RealFftPlan(long nfft);
+  ~RealFftPlan();
+  RealFftPlan(const RealFftPlan &) = delete;
+  RealFftPlan &operator=(const RealFftPlan &) = delete;
+
+ private:
+  kiss_fftr_cfg forwardCfg;
+  kiss_fftr_cfg inverseCfg;
+  mutable std::mutex mutex;
+
+  static std::mutex &cacheMutex();
+  static std::map<long, std::shared_ptr<const RealFftPlan>> &cache();
+};
+
+inline RealFftPlan::RealFftPlan(long nfft) : nfft(nfft) {
+  forwardCfg = kiss_fftr_alloc((int)nfft, 0, nullptr, nullptr);
+  inverseCfg = kiss_fftr_alloc((int)nfft, 1, nullptr, nullptr);
+}
+
+inline RealFftPlan::~RealFftPlan() {
+  kiss_fftr_free(forwardCfg);
+  kiss_fftr_free(inverseCfg);
+}
+
+inline void RealFftPlan::forward(const float *in, kiss_fft_cpx *out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  kiss_fftr(forwardCfg, in, out);
+}
+
+inline void RealFftPlan::inverse(const kiss_fft_cpx *in, float *out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  kiss_fftri(inverseCfg, in, out);
+}
+
+inline std::mutex &RealFftPlan::cacheMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+inline std::map<long, std::shared_ptr<const RealFftPlan>> &
+RealFftPlan::cache() {
+  static std::map<long, std::shared_ptr<const RealFftPlan>> plans;
+  return plans;
+}
+
+inline std::shared_ptr<const RealFftPlan> RealFftPlan::get(long nfft) {
+  std::lock_guard<std::mutex> lock(cacheMutex());
+  std::shared_ptr<const RealFftPlan> &plan = cache()[nfft];
+  if (!plan) plan = std::make_shared<const RealFftPlan>(nfft);
+  return plan;
+}
+
+inline long RealFftPlan::releaseUnused() {
+  std::lock_guard<std::mutex> lock(cacheMutex());
+  long released = 0;
+  for (auto it = cache().begin(); it != cache().end();) {
+    if (it->second.use_count() == 1) {
+      it = cache().erase(it);
+      released++;
+    } else {
+      ++it;
+    }
+  }
+  return released;
+}
+
+/**
+ * @brief Cross-correlation of x (nx samples, mean removed) with y (ny <= nx
+ * samples) at every lag where y lies entirely inside x:
+ * out[lag] = sum_t (x[t + lag] - mean(x)) * y[t], lag = 0 .. nx - ny.
+ *
+ * Computed as X * conj(Y) with real FFTs of nextPowerOfTwo(nx) points; no
+ * valid lag wraps around at that size.
+ *
+ * @param x - nx samples, e.g. a capture
+ * @param nx - length of x
+ * @param y - ny samples, e.g. one MLS period
+ * @param ny - length of y
+ * @param out - nx - ny + 1 lags
+ */
+inline void crossCorrelate(const float *x, long nx, const float *y, long ny,
+                           float *out) {
+  const long nfft = nextPowerOfTwo(nx);
+  const long bins = nfft / 2 + 1;
+  std::shared_ptr<const RealFftPlan> plan = RealFftPlan::get(nfft);
+  std::vector<float> buffer(nfft, 0.0f);
+  std::vector<kiss_fft_cpx> X(bins), Y(bins);
+  double mean = 0;
+  long i;
+
+  for (i = 0; i < nx; i++) mean += x[i];
+  mean /= nx;
+  for (i = 0; i < nx; i++) buffer[i] = (float)(x[i] - mean);
+  plan->forward(buffer.data(), X.data());
+  std::fill(buffer.begin(), buffer.end(), 0.0f);
+  std::copy(y, y + ny, buffer.begin());
+  plan->forward(buffer.data(), Y.data());
+
+  const float scale = 1.0f / nfft;
+  for (i = 0; i < bins; i++) {
+    const float re = X[i].r * Y[i].r + X[i].i * Y[i].i;
+    const float im = X[i].i * Y[i].r - X[i].r * Y[i].i;
+    X[i].r = re * scale;
+    X[i].i = im * scale;
+  }
+  plan->inverse(X.data(), buffer.data());
+  std::copy(buffer.begin(), buffer.begin() + (nx - ny + 1), out);
+}
+
+/**
+ * @brief Sub-sample position of the peak of |r| near index k.
+ *
+ * A parabola through three lags is biased by up to a tenth of a sample on
+ * the sinc-shaped peak of a band-limited correlation, enough to skew the
+ * clock drift fitted over several periods. The correlation is band limited,
+ * so it is first sinc-interpolated kUpsample times over k - 1 .. k + 1 and
+ * the parabola is fitted on the finest grid around the interpolated maximum
+ * (taken with the sign of the peak; the neighbours of a band-limited peak can
+ * swing to the other side of zero).
+ */
+inline double refinePeak(const float *r, long n, long k) {
+  const long kUpsample = 32;
+  static const SincResampler interpolator(1.0 / kUpsample);
+  float fine[2 * kUpsample + 1];
+  const double sign = r[k] < 0 ? -1 : 1;
+  long i, best = kUpsample;
+  interpolator.process(r, n, (double)(k - 1), fine, 2 * kUpsample + 1);
+  for (i = 0; i <= 2 * kUpsample; i++) {
+    if (sign * fine[i] > sign * fine[best]) best = i;
+  }
+  double offset = best;
+  if (best > 0 && best < 2 * kUpsample) {
+    const double a = sign * fine[best - 1], b = sign * fine[best];
+    const double c = sign * fine[best + 1];
+    const double curvature = a - 2 * b + c;
+    if (curvature < 0) offset += 0.5 * (a - c) / curvature;
+  }
+  return k - 1 + offset / kUpsample;
+}
+
+/**
+ * @brief Index of the largest |r[k]| for k in [begin, end).
+ */
+inline long peakIndex(const float *r, long begin, long end) {
+  long best = begin;
+  for (long k = begin + 1; k < end; k++) {
+    if (fabs(r[k]) > fabs(r[best])) best = k;
+  }
+  return best;
+}
+
+/**
+ * @brief Sub-sample onset of the first complete MLS period in a capture.
+ *
+ * The correlation of the capture with one period peaks once per complete
+ * period (with either sign, the speaker may invert polarity), and stays near
+ * zero elsewhere. The first period is the first lag whose |correlation| is a
+ * local maximum above half the largest peak, so silence before the onset and
+ * clock drift across periods do not matter.
+ *
+ * @param capture - length samples
+ * @param length - number of samples in the capture, >= P
+ * @param mls - one period of the MLS at +- 1
+ * @param P - period length
+ * @param correlation - length - P + 1 lags, filled with the correlation
+ * @return double - onset in samples, -1 when the capture is shorter than P
+ */
+inline double estimateMlsOnset(const float *capture, long length,
+                               const float *mls, long P, float *correlation) {
+  if (length < P) return -1;
+  const long lags = length - P + 1;
+  crossCorrelate(capture, length, mls, P, correlation);
+  const long peak = peakIndex(correlation, 0, lags);
+  const double threshold = 0.5 * fabs(correlation[peak]);
+  long k = 0;
+  while (k < lags && fabs(correlation[k]) < threshold) k++;
+  while (k + 1 < lags && fabs(correlation[k + 1]) > fabs(correlation[k])) k++;
+  return refinePeak(correlation, lags, k);
+}
+
+/**
+ * @brief Period of the MLS as recorded, in (fractional) capture samples,
+ * from the correlation peaks of every complete period after the onset.
+ *
+ * With a sink clock running slightly fast or slow against the source, the
+ * k-th peak sits at onset + k * period with period != P. Each peak is
+ * searched for near where the periods found so far predict it, refined to a
+ * fraction of a sample, and the period is the least-squares slope of peak
+ * position against period index.
+ *
+ * @param correlation - lags values from estimateMlsOnset
+ * @param lags - number of lags
+ * @param P - nominal period length
+ * @param onset - onset of the first period (from estimateMlsOnset)
+ * @return double - recorded period length, P when fewer than two periods
+ * are found
+ */
+inline double estimateMlsPeriod(const float *correlation, long lags, long P,
+                                double onset) {
+  const long slack = 8;  // search window around each predicted peak
+  const long first = (long)floor(onset + 0.5);
+  if (onset < 0 || first >= lags) return (double)P;
+  const double threshold = 0.5 * fabs(correlation[first]);
+  double period = (double)P;
+  double sumK = 0, sumX = 0, sumKK = 0, sumKX = 0;
+  long count = 0;
+  for (long k = 0;; k++) {
+    const long predicted = (long)floor(onset + k * period + 0.5);
+    if (predicted + slack >= lags) break;
+    const long begin = predicted > slack ? predicted - slack : 0;
+    const long peak = peakIndex(correlation, begin, predicted + slack + 1);
+    if (fabs(correlation[peak]) < threshold) break;  // end of the signal
+    const double x = refinePeak(correlation, lags, peak);
+    sumK += k;
+    sumX += x;
+    sumKK += double(k) * k;
+    sumKX += k * x;
+    count++;
+    if (count >= 2) {
+      period = (count * sumKX - sumK * sumX) / (count * sumKK - sumK * sumK);
+    }
+  }
+  return period;
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_CORRELATION_HPP_
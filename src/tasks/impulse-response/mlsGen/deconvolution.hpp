@@ -0,0 +1,319 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_DECONVOLUTION_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_DECONVOLUTION_HPP_
+
+#include <vector>
+
+#include "hadamard.hpp"
+#include "tags.hpp"
+#include "threadPool.hpp"
+
+/**
+ * @brief Permute one period of a recording by tagS into the 2^N working
+ * buffer of the Hadamard transform (work[k] = signal[tagSInv[k]]), with
+ * work[0] set to minus the DC term.
+ *
+ * @param signal - P samples
+ * @param tagSInv - inverse tagS permutation (any integer index type)
+ * @param P - period length
+ * @param work - P + 1 elements
+ */
+template <typename T, typename Index>
+inline void permuteSignalByTagS(const float *signal, const Index *tagSInv,
+                                long P, T *work) {
+  long i;
+  double dc = 0;
+  for (i = 0; i < P; i++) dc += signal[i];
+  work[0] = -dc;
+  for (i = 1; i <= P; i++)  // Just a permutation of the measured signal
+    work[i] = signal[tagSInv[i]];
+}
+
+/**
+ * @brief Permute the transformed working buffer by tagL into the impulse
+ * response, scaled by 1 / (P + 1).
+ *
+ * @param work - P + 1 elements, the Hadamard transform
+ * @param tagLInv - inverse tagL permutation
+ * @param P - period length
+ * @param resp - P + 1 samples (resp[P] is zero)
+ */
+template <typename T, typename Index>
+inline void permuteResponseByTagL(const T *work, const Index *tagLInv, long P,
+                                  float *resp) {
+  long i;
+  const double fact = 1 / double(P + 1);
+  for (i = 1; i <= P; i++)  // Just a permutation of the impulse response
+  {
+    resp[tagLInv[i]] = work[i] * fact;
+  }
+  resp[P] = 0;
+}
+
+/**
+ * @brief Fused permute -> Hadamard transform -> permute deconvolution of one
+ * period of a recorded MLS, using a single working buffer of 2^N elements.
+ *
+ * - The tagS permutation is done as a gather (work[k] = signal[tagSInv[k]])
+ *   one cache block at a time, and each block is transformed as soon as it is
+ *   complete. The DC term is summed along the way; block 0 is gathered first
+ *   and transformed last, once the DC term is known.
+ * - The large-stride stages run on column strips as in fastHadamardTransform,
+ *   but instead of copying a finished strip back, its values are scaled by
+ *   1 / (P + 1) and scattered straight into resp through tagLInv.
+ *
+ * With a thread pool, both passes are spread over the threads like
+ * fastHadamardTransform. The DC term is summed per block and the block sums
+ * added in order, so the result is the same for any number of threads.
+ *
+ * @param signal - P samples, one period of the recording
+ * @param tagSInv - inverse tagS permutation (see generateTagSInverse)
+ * @param tagLInv - inverse tagL permutation (see generateTagLInverse)
+ * @param N - MLS order
+ * @param work - 2^N elements of scratch
+ * @param scratch - poolSize(pool) * fhtScratchSize<T>(N) elements
+ * @param resp - P + 1 samples of impulse response (resp[P] is zero)
+ * @param pool - threads to use, nullptr to run on the calling thread
+ */
+template <typename T, typename Index>
+inline void deconvolveMls(const float *signal, const Index *tagSInv,
+                          const Index *tagLInv, long N, T *work, T *scratch,
+                          float *resp, ThreadPool *pool = nullptr) {
+  const long n = 1L << N;
+  const long P = n - 1;
+  const long block = fhtBlockSize<T>(n);
+  const long rows = n / block;
+  const T fact = (T)(1 / double(n));
+  std::vector<double> blockDc(rows);
+  double dc = 0;
+
+  // scatter (as a gather), DC term and the in-block stages
+  parallelFor(pool, rows, [&](long r, long) {
+    T *x = work + r * block;
+    const Index *src = tagSInv + r * block;
+    double sum = 0;
+    for (long k = r == 0 ? 1 : 0; k < block; k++) {
+      x[k] = signal[src[k]];
+      sum += x[k];
+    }
+    blockDc[r] = sum;
+    if (r > 0) fhtBlock(x, block);
+  });
+  for (long r = 0; r < rows; r++) dc += blockDc[r];
+  work[0] = (T)-dc;
+  fhtBlock(work, block);
+
+  // row-to-row stages, the tagL gather (as a scatter) and the scaling
+  if (rows == 1) {
+    for (long k = 0; k < n; k++) resp[tagLInv[k]] = (float)(work[k] * fact);
+  } else {
+    const long width = fhtStripWidth<T>(n);
+    const long stripSize = rows * width;
+    parallelFor(pool, block / width, [&](long strip, long thread) {
+      const long col = strip * width;
+      T *buffer = scratch + thread * stripSize;
+      long k, r;
+      for (r = 0; r < rows; r++) {
+        const T *src = work + r * block + col;
+        T *dst = buffer + r * width;
+        for (k = 0; k < width; k++) dst[k] = src[k];
+      }
+      fhtStages(buffer, stripSize, width);
+      for (r = 0; r < rows; r++) {
+        const T *src = buffer + r * width;
+        const Index *dst = tagLInv + r * block + col;
+        for (k = 0; k < width; k++) resp[dst[k]] = (float)(src[k] * fact);
+      }
+    });
+  }
+  resp[P] = 0;  // tagLInv[0] = P collects the unused DC bin
+}
+
+/**
+ * @brief Deconvolve K recorded MLS periods in one call, sharing the
+ * permutation tables.
+ *
+ * The captures go through deconvolveMls one after the other rather than as
+ * interleaved transforms: the single transform already fills every vector
+ * lane for strides of a register width and up, while interleaving K
+ * transforms multiplies the random-access working set of both permutations
+ * by K and pushes it out of cache (it measured slower per capture at every
+ * order from 12 to 18).
+ *
+ * With a thread pool and at least as many captures as threads, each thread
+ * deconvolves whole captures in its own slice of work and scratch; with fewer
+ * captures they run in turn, each one spread over the pool.
+ *
+ * @param signals - K * P samples, one period of each recording back to back
+ * @param K - number of recordings
+ * @param tagSInv - inverse tagS permutation
+ * @param tagLInv - inverse tagL permutation
+ * @param N - MLS order
+ * @param work - poolSize(pool) * 2^N elements of scratch
+ * @param scratch - poolSize(pool) * fhtScratchSize<T>(N) elements
+ * @param resps - K * (P + 1) samples, the impulse responses back to back
+ * @param pool - threads to use, nullptr to run on the calling thread
+ */
+template <typename T, typename Index>
+inline void deconvolveMlsBatch(const float *signals, long K,
+                               const Index *tagSInv, const Index *tagLInv,
+                               long N, T *work, T *scratch, float *resps,
+                               ThreadPool *pool = nullptr) {
+  const long n = 1L << N;
+  const long P = n - 1;
+  if (K < poolSize(pool)) {
+    for (long c = 0; c < K; c++) {
+      deconvolveMls(signals + c * P, tagSInv, tagLInv, N, work, scratch,
+                    resps + c * (P + 1), pool);
+    }
+    return;
+  }
+  const long scratchSize = fhtScratchSize<T>(N);
+  parallelFor(pool, K, [&](long c, long thread) {
+    deconvolveMls(signals + c * P, tagSInv, tagLInv, N, work + thread * n,
+                  scratch + thread * scratchSize, resps + c * (P + 1));
+  });
+}
+
+/**
+ * @brief permuteSignalByTagS without a tagSInv table: the tags are the
+ * running window of the sequence, so the permutation is done as a scatter
+ * (work[tagS[i]] = signal[i]) while the window is shifted along.
+ *
+ * @param signal - P samples
+ * @param mls - packed MLS of order N
+ * @param unitTags - N positions from findUnitTags
+ * @param N - MLS order
+ * @param work - P + 1 elements
+ */
+template <typename T>
+inline void permuteSignalByMls(const float *signal, const uint64_t *mls,
+                               const long *unitTags, long N, T *work) {
+  const long P = (1L << N) - 1;
+  TagCursor cursor(mls, unitTags, N, 0);
+  double dc = 0;
+  for (long i = 0; i < P; i++, cursor.next()) {
+    work[cursor.tagS] = signal[i];
+    dc += signal[i];
+  }
+  work[0] = -dc;
+}
+
+/**
+ * @brief permuteResponseByTagL without a tagLInv table: tagL is run forward
+ * by its recurrence and the permutation done as a gather,
+ * resp[i] = work[tagL[i]] / (P + 1).
+ *
+ * @param work - P + 1 elements, the Hadamard transform
+ * @param mls - packed MLS of order N
+ * @param unitTags - N positions from findUnitTags
+ * @param N - MLS order
+ * @param resp - P + 1 samples (resp[P] is zero)
+ */
+template <typename T>
+inline void permuteResponseByMls(const T *work, const uint64_t *mls,
+                                 const long *unitTags, long N, float *resp) {
+  const long P = (1L << N) - 1;
+  const double fact = 1 / double(P + 1);
+  TagCursor cursor(mls, unitTags, N, 0);
+  for (long i = 0; i < P; i++, cursor.next()) {
+    resp[i] = work[cursor.tagL()] * fact;
+  }
+  resp[P] = 0;
+}
+
+/**
+ * @brief Range walks of the table-free permutations for an order known at
+ * run time, advancing a TagCursor; MLSGenT<N> provides the same two walks
+ * with the order fixed at compile time.
+ */
+struct RuntimeMlsOrder {
+  /**
+   * @brief work[tagS[i]] = signal[i] for i in [begin, end).
+   *
+   * @return double - sum of the signal over the range
+   */
+  template <typename T>
+  static double scatter(const float *signal, const uint64_t *mls,
+                        const long *unitTags, long N, long begin, long end,
+                        T *work) {
+    TagCursor cursor(mls, unitTags, N, begin);
+    double sum = 0;
+    for (long i = begin; i < end; i++, cursor.next()) {
+      work[cursor.tagS] = (T)signal[i];
+      sum += signal[i];
+    }
+    return sum;
+  }
+
+  /**
+   * @brief resp[i] = work[tagL[i]] * fact for i in [begin, end).
+   */
+  template <typename T>
+  static void gather(const T *work, const uint64_t *mls, const long *unitTags,
+                     long N, long begin, long end, T fact, float *resp) {
+    TagCursor cursor(mls, unitTags, N, begin);
+    for (long i = begin; i < end; i++, cursor.next()) {
+      resp[i] = (float)(work[cursor.tagL()] * fact);
+    }
+  }
+};
+
+/**
+ * @brief deconvolveMls for plans without tag tables (kTagsOnTheFly): the
+ * signal is scattered by the running tagS, transformed, and the response
+ * gathered by the running tagL, so only the packed sequence (one bit per
+ * sample instead of two table entries) has to be kept.
+ *
+ * The scatter and the gather do random accesses into work instead of into
+ * the tables, and the transform cannot be fused with them, so this is the
+ * slower path; it is the one for orders whose tables would not fit in memory.
+ * With a pool both permutations are split into kChunks ranges, each cursor
+ * seeked to the start of its range. The DC term is summed per range and the
+ * sums added in order, so the result is the same for any number of threads.
+ *
+ * @tparam Order - RuntimeMlsOrder, or MLSGenT<N> for the walks of order N
+ * (see onTheFlyKernel)
+ * @param signal - P samples, one period of the recording
+ * @param mls - packed MLS of order N
+ * @param unitTags - N positions from findUnitTags
+ * @param N - MLS order
+ * @param work - 2^N elements of scratch
+ * @param scratch - poolSize(pool) * fhtScratchSize<T>(N) elements
+ * @param resp - P + 1 samples of impulse response (resp[P] is zero)
+ * @param pool - threads to use, nullptr to run on the calling thread
+ */
+template <typename T, typename Order = RuntimeMlsOrder>
+inline void deconvolveMlsOnTheFly(const float *signal, const uint64_t *mls,
+                                  const long *unitTags, long N, T *work,
+                                  T *scratch, float *resp,
+                                  ThreadPool *pool = nullptr) {
+  const long kChunks = 64;
+  const long P = (1L << N) - 1;
+  const long chunk = (P + kChunks - 1) / kChunks;
+  const T fact = (T)(1 / double(P + 1));
+  double chunkDc[kChunks];
+  double dc = 0;
+
+  parallelFor(pool, kChunks, [&](long c, long) {
+    const long begin = c * chunk;
+    const long end = begin + chunk < P ? begin + chunk : P;
+    chunkDc[c] = begin < end ? Order::scatter(signal, mls, unitTags, N, begin,
+                                              end, work)
+                             : 0;
+  });
+  for (long c = 0; c < kChunks; c++) dc += chunkDc[c];
+  work[0] = (T)-dc;
+
+  fastHadamardTransform(work, N, scratch, pool);
+
+  parallelFor(pool, kChunks, [&](long c, long) {
+    const long begin = c * chunk;
+    const long end = begin + chunk < P ? begin + chunk : P;
+    if (begin < end) {
+      Order::gather(work, mls, unitTags, N, begin, end, fact, resp);
+    }
+  });
+  resp[P] = 0;
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_DECONVOLUTION_HPP_
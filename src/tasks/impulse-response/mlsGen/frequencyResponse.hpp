@@ -0,0 +1,221 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_FREQUENCYRESPONSE_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_FREQUENCYRESPONSE_HPP_
+
+#include <math.h>
+
+#include <memory>
+#include <vector>
+
+#include "correlation.hpp"
+
+/**
+ * @brief Phase of the impulse response designed from a gain curve, the
+ * calibrateSoundIIRPhase of a calibration ('linear' or 'minimum').
+ */
+enum FilterPhase {
+  kLinearPhase = 0,   // symmetric, delayed by (length - 1) / 2 samples
+  kMinimumPhase = 1,  // energy as early as possible, no pre-ringing
+};
+
+// Floor of the gains in dB, for bins where the response is exactly zero
+const double kMinGainDb = -240;
+
+/**
+ * @brief Number of frequencies frequencyResponse returns for an impulse
+ * response of n samples: the bins of a real FFT of nextPowerOfTwo(n) points.
+ */
+inline long frequencyResponseBins(long n) {
+  return nextPowerOfTwo(n) / 2 + 1;
+}
+
+/**
+ * @brief Gain (in dB) of an impulse response at the bins of its zero-padded
+ * real FFT, frequencies[k] = k * sampleRate / nfft with nfft =
+ * nextPowerOfTwo(n).
+ *
+ * @param ir - n samples of impulse response at sampleRate
+ * @param n - length of ir
+ * @param sampleRate - sampling rate of ir in Hz
+ * @param frequencies - frequencyResponseBins(n) frequencies in Hz
+ * @param gains - frequencyResponseBins(n) gains in dB (20 log10 |H|)
+ */
+inline void frequencyResponse(const float *ir, long n, double sampleRate,
+                              float *frequencies, float *gains) {
+  const long nfft = nextPowerOfTwo(n);
+  const long bins = nfft / 2 + 1;
+  std::shared_ptr<const RealFftPlan> plan = RealFftPlan::get(nfft);
+  std::vector<float> buffer(nfft, 0.0f);
+  std::vector<kiss_fft_cpx> H(bins);
+  long i, k;
+
+  for (i = 0; i < n; i++) buffer[i] = ir[i];
+  plan->forward(buffer.data(), H.data());
+  for (k = 0; k < bins; k++) {
+    const double magnitude = hypot(H[k].r, H[k].i);
+    frequencies[k] = (float)(k * sampleRate / nfft);
+    gains[k] = (float)(magnitude > 0 ? fmax(20 * log10(magnitude), kMinGainDb)
+                                     : kMinGainDb);
+  }
+}
+
+/**
+ * @brief Gain of a curve at a frequency just below frequencies[index] (the
+ * first point of the curve at or above it, count when there is none).
+ */
+inline double gainBefore(const float *frequencies, const float *gains,
+                         long count, long index, double frequency) {
+  if (index == 0) return gains[0];
+  if (index == count) return gains[count - 1];
+  const double x0 = frequencies[index - 1], x1 = frequencies[index];
+  const double y0 = gains[index - 1], y1 = gains[index];
+  return x1 > x0 ? y0 + (y1 - y0) * (frequency - x0) / (x1 - x0) : y1;
+}
+
+/**
+ * @brief Gain of a curve at one frequency, interpolated linearly between the
+ * two nearest frequencies and held at the end values outside the curve
+ * (the findGainatFrequency of the calibration).
+ *
+ * @param frequencies - count increasing frequencies in Hz
+ * @param gains - count gains in dB
+ * @param count - number of points of the curve
+ * @param frequency - frequency to evaluate, in Hz
+ */
+inline double gainAtFrequency(const float *frequencies, const float *gains,
+                              long count, double frequency) {
+  long index = 0;
+  while (index < count && frequencies[index] < frequency) index++;
+  return gainBefore(frequencies, gains, count, index, frequency);
+}
+
+/**
+ * @brief Magnitudes of the bins of a real FFT of nfft points, from a gain
+ * curve in dB interpolated as in gainAtFrequency. The bins are in increasing
+ * frequency, so the curve is walked once.
+ */
+inline void gainCurveToBins(const float *frequencies, const float *gains,
+                            long count, double sampleRate, long nfft,
+                            std::vector<double> &magnitudes) {
+  const long bins = nfft / 2 + 1;
+  long index = 0;
+  magnitudes.resize(bins);
+  for (long k = 0; k < bins; k++) {
+    const double f = k * sampleRate / nfft;
+    while (index < count && frequencies[index] < f) index++;
+    const double gain = gainBefore(frequencies, gains, count, index, f);
+    magnitudes[k] = pow(10, gain / 20);
+  }
+}
+
+/**
+ * @brief Linear-phase FIR by frequency sampling (as scipy's firwin2): the
+ * curve is sampled on 2 * nextPowerOfTwo(length) points, delayed by
+ * (length - 1) / 2 samples, inverse transformed and truncated to length
+ * samples under a Hamming window.
+ */
+inline void linearPhaseImpulseResponse(const std::vector<double> &magnitudes,
+                                       long nfft, long length, float *ir) {
+  const long bins = nfft / 2 + 1;
+  std::shared_ptr<const RealFftPlan> plan = RealFftPlan::get(nfft);
+  std::vector<kiss_fft_cpx> H(bins);
+  std::vector<float> buffer(nfft);
+  const double delay = (length - 1) / 2.0;
+  long i, k;
+
+  for (k = 0; k < bins; k++) {
+    const double phase = -2 * M_PI * k * delay / nfft;
+    H[k].r = (float)(magnitudes[k] * cos(phase));
+    H[k].i = (float)(magnitudes[k] * sin(phase));
+  }
+  // an even length has a half-sample delay, which a real response cannot
+  // have at Nyquist
+  if (length % 2 == 0) H[bins - 1].r = H[bins - 1].i = 0;
+  plan->inverse(H.data(), buffer.data());
+  for (i = 0; i < length; i++) {
+    const double window =
+        length > 1 ? 0.54 - 0.46 * cos(2 * M_PI * i / (length - 1)) : 1;
+    ir[i] = (float)(buffer[i] * window / nfft);
+  }
+}
+
+/**
+ * @brief Phase (in rad) of the minimum-phase response with the given
+ * magnitudes at the nfft / 2 + 1 bins of an nfft point real FFT, from the
+ * real cepstrum: the log magnitude is inverse transformed, folded onto
+ * positive quefrencies and transformed back, its imaginary part being the
+ * phase. A larger nfft keeps the cepstral aliasing down.
+ */
+inline void minimumPhaseAngles(const std::vector<double> &magnitudes,
+                               long nfft, std::vector<double> &angles) {
+  const long bins = nfft / 2 + 1;
+  std::shared_ptr<const RealFftPlan> plan = RealFftPlan::get(nfft);
+  std::vector<kiss_fft_cpx> H(bins);
+  std::vector<float> cepstrum(nfft);
+  const double floor = pow(10, kMinGainDb / 20);
+  long i, k;
+
+  for (k = 0; k < bins; k++) {
+    H[k].r = (float)log(fmax(magnitudes[k], floor));
+    H[k].i = 0;
+  }
+  plan->inverse(H.data(), cepstrum.data());
+  for (i = 0; i < nfft; i++) {
+    const double fold = i == 0 || i == nfft / 2 ? 1 : i < nfft / 2 ? 2 : 0;
+    cepstrum[i] = (float)(cepstrum[i] * fold / nfft);
+  }
+  plan->forward(cepstrum.data(), H.data());
+  angles.resize(bins);
+  for (k = 0; k < bins; k++) angles[k] = H[k].i;
+}
+
+/**
+ * @brief Minimum-phase FIR: the magnitudes with minimumPhaseAngles, on 4 *
+ * nextPowerOfTwo(length) points to keep the cepstral aliasing down, inverse
+ * transformed and truncated to length samples.
+ */
+inline void minimumPhaseImpulseResponse(const std::vector<double> &magnitudes,
+                                        long nfft, long length, float *ir) {
+  const long bins = nfft / 2 + 1;
+  std::shared_ptr<const RealFftPlan> plan = RealFftPlan::get(nfft);
+  std::vector<kiss_fft_cpx> H(bins);
+  std::vector<float> buffer(nfft);
+  std::vector<double> angles;
+  long i, k;
+
+  minimumPhaseAngles(magnitudes, nfft, angles);
+  for (k = 0; k < bins; k++) {
+    H[k].r = (float)(magnitudes[k] * cos(angles[k]));
+    H[k].i = (float)(magnitudes[k] * sin(angles[k]));
+  }
+  plan->inverse(H.data(), buffer.data());
+  for (i = 0; i < length; i++) ir[i] = buffer[i] / nfft;
+}
+
+/**
+ * @brief Impulse response of length samples whose gain follows a curve, the
+ * inverse of frequencyResponse for a simulated transducer given as a gain
+ * curve.
+ *
+ * @param frequencies - count increasing frequencies in Hz
+ * @param gains - count gains in dB
+ * @param count - number of points of the curve, at least 1
+ * @param sampleRate - sampling rate of ir in Hz
+ * @param length - samples of impulse response, at least 1
+ * @param phase - kLinearPhase or kMinimumPhase
+ * @param ir - length samples
+ */
+inline void impulseResponseFromGains(const float *frequencies,
+                                     const float *gains, long count,
+                                     double sampleRate, long length,
+                                     FilterPhase phase, float *ir) {
+  const long nfft = (phase == kMinimumPhase ? 4 : 2) * nextPowerOfTwo(length);
+  std::vector<double> magnitudes;
+  gainCurveToBins(frequencies, gains, count, sampleRate, nfft, magnitudes);
+  if (phase == kMinimumPhase) {
+    minimumPhaseImpulseResponse(magnitudes, nfft, length, ir);
+  } else {
+    linearPhaseImpulseResponse(magnitudes, nfft, length, ir);
+  }
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_FREQUENCYRESPONSE_HPP_
@@ -0,0 +1,210 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_HADAMARD_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_HADAMARD_HPP_
+
+#include "simd.hpp"
+#include "threadPool.hpp"
+
+/**
+ * @brief Bytes of working set the blocked transform aims to keep in cache
+ * (one L1 data cache on most desktop and phone cores).
+ */
+const long kFhtBlockBytes = 32768;
+
+/**
+ * @brief In-place 8 point Walsh-Hadamard transform (strides 1, 2 and 4) held
+ * entirely in registers.
+ */
+template <typename T>
+inline void fht8(T *x) {
+  const T a0 = x[0] + x[1], a1 = x[0] - x[1];
+  const T a2 = x[2] + x[3], a3 = x[2] - x[3];
+  const T a4 = x[4] + x[5], a5 = x[4] - x[5];
+  const T a6 = x[6] + x[7], a7 = x[6] - x[7];
+  const T b0 = a0 + a2, b2 = a0 - a2, b1 = a1 + a3, b3 = a1 - a3;
+  const T b4 = a4 + a6, b6 = a4 - a6, b5 = a5 + a7, b7 = a5 - a7;
+  x[0] = b0 + b4;
+  x[1] = b1 + b5;
+  x[2] = b2 + b6;
+  x[3] = b3 + b7;
+  x[4] = b0 - b4;
+  x[5] = b1 - b5;
+  x[6] = b2 - b6;
+  x[7] = b3 - b7;
+}
+
+/**
+ * @brief One radix-2 butterfly stage with the given stride over n elements.
+ */
+template <typename T>
+inline void fhtRadix2(T *x, long n, long stride) {
+  typedef Vec<T> V;
+  long i, k;
+  for (i = 0; i < n; i += 2 * stride) {
+    T *a = x + i;
+    T *b = a + stride;
+    k = 0;
+    if (stride >= V::width) {
+      for (; k < stride; k += V::width) {
+        const typename V::type va = V::load(a + k), vb = V::load(b + k);
+        V::store(a + k, V::add(va, vb));
+        V::store(b + k, V::sub(va, vb));
+      }
+    }
+    for (; k < stride; k++) {
+      const T va = a[k], vb = b[k];
+      a[k] = va + vb;
+      b[k] = va - vb;
+    }
+  }
+}
+
+/**
+ * @brief Two fused butterfly stages (strides s and 2s) over n elements, so
+ * each element is loaded and stored once per pair of stages.
+ */
+template <typename T>
+inline void fhtRadix4(T *x, long n, long stride) {
+  typedef Vec<T> V;
+  long i, k;
+  for (i = 0; i < n; i += 4 * stride) {
+    T *a = x + i;
+    T *b = a + stride;
+    T *c = b + stride;
+    T *d = c + stride;
+    k = 0;
+    if (stride >= V::width) {
+      for (; k < stride; k += V::width) {
+        const typename V::type va = V::load(a + k), vb = V::load(b + k);
+        const typename V::type vc = V::load(c + k), vd = V::load(d + k);
+        const typename V::type s0 = V::add(va, vb), d0 = V::sub(va, vb);
+        const typename V::type s1 = V::add(vc, vd), d1 = V::sub(vc, vd);
+        V::store(a + k, V::add(s0, s1));
+        V::store(b + k, V::add(d0, d1));
+        V::store(c + k, V::sub(s0, s1));
+        V::store(d + k, V::sub(d0, d1));
+      }
+    }
+    for (; k < stride; k++) {
+      const T s0 = a[k] + b[k], d0 = a[k] - b[k];
+      const T s1 = c[k] + d[k], d1 = c[k] - d[k];
+      a[k] = s0 + s1;
+      b[k] = d0 + d1;
+      c[k] = s0 - s1;
+      d[k] = d0 - d1;
+    }
+  }
+}
+
+/**
+ * @brief Run every stage with stride firstStride, 2 firstStride, ..., n / 2
+ * over n elements, two stages per pass where possible.
+ */
+template <typename T>
+inline void fhtStages(T *x, long n, long firstStride) {
+  long stride = firstStride;
+  for (; 4 * stride <= n; stride *= 4) fhtRadix4(x, n, stride);
+  if (2 * stride <= n) fhtRadix2(x, n, stride);
+}
+
+/**
+ * @brief Complete Walsh-Hadamard transform of a contiguous block of n = 2^k
+ * elements that fits in cache: 8 point register kernels for the three
+ * smallest strides, then vector butterflies for the rest.
+ */
+template <typename T>
+inline void fhtBlock(T *x, long n) {
+  if (n < 8) {
+    fhtStages(x, n, 1);
+    return;
+  }
+  for (long i = 0; i < n; i += 8) fht8(x + i);
+  fhtStages(x, n, 8);
+}
+
+/**
+ * @brief Number of elements of T per cache block of the transform.
+ */
+template <typename T>
+constexpr long fhtBlockSize(long n) {
+  const long block = kFhtBlockBytes / (long)sizeof(T);
+  return n < block ? n : block;
+}
+
+/**
+ * @brief Width (in elements) of the column strips used for the large-stride
+ * stages, chosen so rows x width fills one cache block.
+ */
+template <typename T>
+constexpr long fhtStripWidth(long n) {
+  const long rows = n / fhtBlockSize<T>(n);
+  long width = fhtBlockSize<T>(n) / rows;
+  if (width < 16) width = 16;
+  if (width > fhtBlockSize<T>(n)) width = fhtBlockSize<T>(n);
+  return width;
+}
+
+/**
+ * @brief Size (in elements of T) of the scratch buffer fastHadamardTransform
+ * needs for a transform of order N. Zero when the whole transform fits in one
+ * cache block.
+ */
+template <typename T>
+constexpr long fhtScratchSize(long N) {
+  const long n = 1L << N;
+  const long rows = n / fhtBlockSize<T>(n);
+  return rows > 1 ? rows * fhtStripWidth<T>(n) : 0;
+}
+
+/**
+ * @brief In-place (unnormalized) fast Walsh-Hadamard transform of 2^N
+ * elements. The butterflies commute, so the stages are reordered for cache
+ * locality instead of running from the largest stride down:
+ *
+ * - pass 1 transforms each cache-sized block on its own (every stride below
+ *   the block size);
+ * - pass 2 views the array as rows of one block each and, one narrow column
+ *   strip at a time, copies the strip into scratch, runs the remaining
+ *   (row-to-row) stages on it there and copies it back. The copy avoids the
+ *   cache set conflicts of power-of-two row strides.
+ *
+ * T may be float, or double for a double-precision accumulator. With a
+ * thread pool, the blocks of pass 1 and the strips of pass 2 are spread over
+ * the threads; each strip is transformed the same way whatever thread runs
+ * it, so the output does not depend on the number of threads.
+ *
+ * @param x - 2^N elements, transformed in place
+ * @param N - transform order
+ * @param scratch - poolSize(pool) * fhtScratchSize<T>(N) elements
+ * @param pool - threads to use, nullptr to run on the calling thread
+ */
+template <typename T>
+inline void fastHadamardTransform(T *x, long N, T *scratch,
+                                  ThreadPool *pool = nullptr) {
+  const long n = 1L << N;
+  const long block = fhtBlockSize<T>(n);
+  const long rows = n / block;
+
+  parallelFor(pool, rows, [&](long r, long) { fhtBlock(x + r * block, block); });
+  if (rows == 1) return;
+
+  const long width = fhtStripWidth<T>(n);
+  const long stripSize = rows * width;
+  parallelFor(pool, block / width, [&](long strip, long thread) {
+    const long col = strip * width;
+    T *buffer = scratch + thread * stripSize;
+    long i, r;
+    for (r = 0; r < rows; r++) {
+      const T *src = x + r * block + col;
+      T *dst = buffer + r * width;
+      for (i = 0; i < width; i++) dst[i] = src[i];
+    }
+    fhtStages(buffer, stripSize, width);
+    for (r = 0; r < rows; r++) {
+      const T *src = buffer + r * width;
+      T *dst = x + r * block + col;
+      for (i = 0; i < width; i++) dst[i] = src[i];
+    }
+  });
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_HADAMARD_HPP_
@@ -0,0 +1,60 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_INPUTARENA_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_INPUTARENA_HPP_
+
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Input buffers (slots) that javascript writes recordings into
+ * directly, reused from one capture to the next. A slot is only reallocated
+ * when a capture outgrows it, and then by at least half its size again, so
+ * repeated captures of similar length allocate nothing and a view handed to
+ * javascript stays valid until the slot grows (or the WASM memory does).
+ */
+class InputArena {
+ public:
+  /**
+   * @brief Buffer of slot index holding at least size samples. The contents
+   * are kept unless the slot has to grow.
+   */
+  float *slot(long index, long size) {
+    if ((long)slots.size() <= index) slots.resize(index + 1);
+    Slot &s = slots[index];
+    if (s.capacity < size) {
+      const long grown = s.capacity + s.capacity / 2;
+      s.capacity = size > grown ? size : grown;
+      s.data.reset(new float[s.capacity]);
+    }
+    return s.data.get();
+  }
+
+  /**
+   * @brief Buffer of slot index as it is, nullptr if it was never used.
+   */
+  float *data(long index) const {
+    return index < (long)slots.size() ? slots[index].data.get() : nullptr;
+  }
+
+  /**
+   * @brief Bytes held by every slot.
+   */
+  long bytes() const {
+    long total = 0;
+    for (const Slot &s : slots) total += s.capacity * (long)sizeof(float);
+    return total;
+  }
+
+  /**
+   * @brief Free every slot.
+   */
+  void release() { slots.clear(); }
+
+ private:
+  struct Slot {
+    std::unique_ptr<float[]> data;
+    long capacity = 0;
+  };
+  std::vector<Slot> slots;
+};
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_INPUTARENA_HPP_
@@ -0,0 +1,272 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_INVERSEFILTER_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_INVERSEFILTER_HPP_
+
+#include <math.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "correlation.hpp"
+#include "frequencyResponse.hpp"
+
+// Dynamic range of the inverse by default: bins more than 40 dB below the
+// strongest bin of the band are boosted less than their full inverse
+const double kDefaultRegularizationDb = 40;
+
+// Band edges roll off over a third of an octave with a raised cosine
+const double kBandEdgeOctaves = 1.0 / 3;
+
+/**
+ * @brief Settings of designInverseFilter, the parameters of the inverse
+ * impulse response tasks of the Python server.
+ */
+struct InverseFilterOptions {
+  double lowHz;                 // band of the inverse filter
+  double highHz;
+  double regularizationDb;      // dynamic range of the inverse, dB
+  double maxBoostDb;            // peak gain of the inverse filter, dB
+  double smoothOctaves;         // width of the smoothing of the gains
+  double smoothMinBandwidthHz;  // narrowest smoothing window, Hz
+  long length;                  // samples of inverse impulse response
+  FilterPhase phase;
+};
+
+/**
+ * @brief Measured response and inverse filter of designInverseFilter.
+ */
+struct InverseFilter {
+  std::vector<float> frequencies;      // Hz, the bins of the measured IRs
+  std::vector<float> gainsOrigin;      // dB, measured (less the known curve)
+  std::vector<float> gains;            // dB, gainsOrigin smoothed
+  std::vector<float> angles;           // rad, phase of the measured response
+  std::vector<float> componentAngles;  // rad, less the known curve's phase
+  std::vector<float> iir;              // inverse within the band
+  std::vector<float> iirNoBandpass;    // inverse over every frequency
+  double attenuatorGainDb;             // gain to reach maxBoostDb, not in iir
+  double fMaxHz;                       // frequency of the peak of the inverse
+};
+
+/**
+ * @brief Power-averaged gain (in dB) and phase of count impulse responses of
+ * n samples each, at the bins of their zero-padded real FFT (see
+ * frequencyResponse). The phase is that of the sum of the responses.
+ */
+inline void averageResponse(const float *irs, long count, long n,
+                            double sampleRate, InverseFilter &filter) {
+  const long nfft = nextPowerOfTwo(n);
+  const long bins = nfft / 2 + 1;
+  std::shared_ptr<const RealFftPlan> plan = RealFftPlan::get(nfft);
+  std::vector<float> buffer(nfft, 0.0f);
+  std::vector<kiss_fft_cpx> H(bins);
+  std::vector<double> power(bins, 0.0), re(bins, 0.0), im(bins, 0.0);
+  long c, i, k;
+
+  for (c = 0; c < count; c++) {
+    for (i = 0; i < n; i++) buffer[i] = irs[c * n + i];
+    plan->forward(buffer.data(), H.data());
+    for (k = 0; k < bins; k++) {
+      power[k] += (double)H[k].r * H[k].r + (double)H[k].i * H[k].i;
+      re[k] += H[k].r;
+      im[k] += H[k].i;
+    }
+  }
+  filter.frequencies.resize(bins);
+  filter.gainsOrigin.resize(bins);
+  filter.angles.resize(bins);
+  for (k = 0; k < bins; k++) {
+    const double mean = power[k] / count;
+    filter.frequencies[k] = (float)(k * sampleRate / nfft);
+    filter.gainsOrigin[k] =
+        (float)(mean > 0 ? fmax(10 * log10(mean), kMinGainDb) : kMinGainDb);
+    filter.angles[k] = (float)atan2(im[k], re[k]);
+  }
+}
+
+/**
+ * @brief Phase of the measured response less that of the known curve, taken
+ * to be minimum phase (a calibrated microphone is given by its gains alone),
+ * wrapped to [-pi, pi]: the phase of the component when the measured system
+ * is the component followed by the known one.
+ *
+ * @param knownDb - gains in dB of the known curve at the bins of angles
+ */
+inline void componentPhase(const std::vector<float> &angles,
+                           const std::vector<double> &knownDb,
+                           std::vector<float> &componentAngles) {
+  const long bins = (long)angles.size();
+  // 4 times the points of the measurement, as minimumPhaseImpulseResponse
+  const long oversample = 4;
+  const long nfft = oversample * 2 * (bins - 1);
+  std::vector<double> magnitudes(nfft / 2 + 1), knownAngles;
+  long k;
+
+  for (k = 0; k < nfft / 2 + 1; k++) {
+    // the known gains interpolated linearly between the measured bins
+    const long low = std::min(k / oversample, bins - 1);
+    const long high = std::min(low + 1, bins - 1);
+    const double t = (double)(k % oversample) / oversample;
+    magnitudes[k] = pow(10, (knownDb[low] * (1 - t) + knownDb[high] * t) / 20);
+  }
+  minimumPhaseAngles(magnitudes, nfft, knownAngles);
+  componentAngles.resize(bins);
+  for (k = 0; k < bins; k++) {
+    const double phase = angles[k] - knownAngles[k * oversample];
+    componentAngles[k] = (float)atan2(sin(phase), cos(phase));
+  }
+}
+
+/**
+ * @brief Smooth gains (in dB) at evenly spaced frequencies by averaging
+ * their power over smoothOctaves around each frequency, and over at least
+ * minBandwidthHz. The windows are summed from a running total, so any width
+ * costs the same.
+ */
+inline void smoothGains(const std::vector<float> &frequencies,
+                        const std::vector<float> &gains, double smoothOctaves,
+                        double minBandwidthHz, std::vector<float> &smoothed) {
+  const long bins = (long)gains.size();
+  smoothed = gains;
+  if (bins < 2 || (smoothOctaves <= 0 && minBandwidthHz <= 0)) return;
+  const double spacing = frequencies[1] - frequencies[0];
+  const double widen = pow(2, smoothOctaves / 2);
+  std::vector<double> total(bins + 1, 0.0);
+  long k;
+
+  for (k = 0; k < bins; k++) total[k + 1] = total[k] + pow(10, gains[k] / 10);
+  for (k = 0; k < bins; k++) {
+    double low = frequencies[k] / widen, high = frequencies[k] * widen;
+    if (high - low < minBandwidthHz) {
+      low = frequencies[k] - minBandwidthHz / 2;
+      high = frequencies[k] + minBandwidthHz / 2;
+    }
+    const long first = std::max(0L, (long)ceil(low / spacing));
+    const long last = std::min(bins - 1, (long)floor(high / spacing));
+    if (last <= first) continue;
+    const double mean = (total[last + 1] - total[first]) / (last - first + 1);
+    smoothed[k] = (float)(mean > 0 ? fmax(10 * log10(mean), kMinGainDb)
+                                   : kMinGainDb);
+  }
+}
+
+/**
+ * @brief Weight of a frequency in the band lowHz to highHz: 1 inside, a
+ * raised cosine down to 0 over kBandEdgeOctaves outside each edge.
+ */
+inline double bandWeight(double frequency, double lowHz, double highHz) {
+  double octaves = 0;
+  if (frequency < lowHz) {
+    octaves = frequency > 0 ? log2(lowHz / frequency) : kBandEdgeOctaves;
+  } else if (frequency > highHz) {
+    octaves = log2(frequency / highHz);
+  }
+  if (octaves >= kBandEdgeOctaves) return 0;
+  return 0.5 + 0.5 * cos(M_PI * octaves / kBandEdgeOctaves);
+}
+
+/**
+ * @brief Gain (in dB) of the regularized inverse of gains: |H| / (|H|^2 +
+ * beta) with beta = max|H|^2 10^(-regularizationDb / 10), max|H| taken in the
+ * band. It follows 1 / |H| within regularizationDb of the strongest bin and
+ * falls back to |H| / beta below, so deep notches are not boosted without
+ * bound. With bandpass the inverse is weighted by bandWeight.
+ */
+inline void regularizedInverse(const std::vector<float> &frequencies,
+                               const std::vector<float> &gains,
+                               const InverseFilterOptions &options,
+                               bool bandpass, std::vector<float> &inverse) {
+  const long bins = (long)gains.size();
+  double strongest = kMinGainDb;
+  long k;
+
+  for (k = 0; k < bins; k++) {
+    if (frequencies[k] >= options.lowHz && frequencies[k] <= options.highHz) {
+      strongest = fmax(strongest, gains[k]);
+    }
+  }
+  const double beta = pow(10, (strongest - options.regularizationDb) / 10);
+  inverse.resize(bins);
+  for (k = 0; k < bins; k++) {
+    const double power = pow(10, gains[k] / 10);
+    double gain = 10 * log10(power) - 20 * log10(power + beta);
+    if (bandpass) {
+      const double weight =
+          bandWeight(frequencies[k], options.lowHz, options.highHz);
+      gain = weight > 0 ? gain + 20 * log10(weight) : kMinGainDb;
+    }
+    inverse[k] = (float)fmax(gain, kMinGainDb);
+  }
+}
+
+/**
+ * @brief Design the inverse filter of a measured system or component: the
+ * filter that, played before it, makes its response flat over the band.
+ *
+ * The count impulse responses are averaged in power, the known curve (e.g.
+ * the calibrated microphone, for a component calibration) is subtracted and
+ * the result smoothed; its minimum phase is taken out of the measured phase
+ * for the component's (componentPhase). Its regularized inverse, within the band and over all
+ * frequencies, is turned into options.length samples of linear or minimum
+ * phase impulse response (impulseResponseFromGains) on the cached FFT plans.
+ * Like the server's, the responses leave out attenuatorGainDb, the gain that
+ * brings the peak in the band to maxBoostDb: the convolution applies it.
+ *
+ * @param irs - count impulse responses of n samples, one after the other
+ * @param count - number of impulse responses, at least 1
+ * @param n - length of each impulse response, at least 1
+ * @param sampleRate - sampling rate of the responses in Hz
+ * @param knownFrequencies - knownCount increasing frequencies in Hz
+ * @param knownGains - knownCount gains in dB
+ * @param knownCount - points of the known curve, 0 for none
+ * @param options - band, regularization and shape of the filter
+ * @param filter - the measured response and the two inverse filters
+ */
+inline void designInverseFilter(const float *irs, long count, long n,
+                                double sampleRate,
+                                const float *knownFrequencies,
+                                const float *knownGains, long knownCount,
+                                const InverseFilterOptions &options,
+                                InverseFilter &filter) {
+  std::vector<float> inverse;
+  long k, index = 0;
+
+  averageResponse(irs, count, n, sampleRate, filter);
+  const long bins = (long)filter.frequencies.size();
+  std::vector<double> knownDb(bins, 0.0);
+  for (k = 0; k < bins && knownCount > 0; k++) {
+    const double f = filter.frequencies[k];
+    while (index < knownCount && knownFrequencies[index] < f) index++;
+    knownDb[k] =
+        gainBefore(knownFrequencies, knownGains, knownCount, index, f);
+    filter.gainsOrigin[k] -= (float)knownDb[k];
+  }
+  if (knownCount > 0 && bins > 1) {
+    componentPhase(filter.angles, knownDb, filter.componentAngles);
+  } else {
+    filter.componentAngles = filter.angles;
+  }
+  smoothGains(filter.frequencies, filter.gainsOrigin, options.smoothOctaves,
+              options.smoothMinBandwidthHz, filter.gains);
+
+  // the band-limited inverse sets the level of both
+  regularizedInverse(filter.frequencies, filter.gains, options, true, inverse);
+  long peak = 0;
+  for (k = 1; k < bins; k++) {
+    if (inverse[k] > inverse[peak]) peak = k;
+  }
+  filter.fMaxHz = filter.frequencies[peak];
+  filter.attenuatorGainDb = options.maxBoostDb - inverse[peak];
+  filter.iir.resize(options.length);
+  impulseResponseFromGains(filter.frequencies.data(), inverse.data(), bins,
+                           sampleRate, options.length, options.phase,
+                           filter.iir.data());
+
+  regularizedInverse(filter.frequencies, filter.gains, options, false,
+                     inverse);
+  filter.iirNoBandpass.resize(options.length);
+  impulseResponseFromGains(filter.frequencies.data(), inverse.data(), bins,
+                           sampleRate, options.length, options.phase,
+                           filter.iirNoBandpass.data());
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_INVERSEFILTER_HPP_
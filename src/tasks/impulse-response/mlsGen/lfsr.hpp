@@ -0,0 +1,171 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_LFSR_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_LFSR_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief Feedback mask of an LFSR from the exponents of its primitive
+ * polynomial x^a + x^b (+ x^c + x^d) + 1: cell j of the delay line feeds back
+ * with a delay of j + 1 samples, so exponent e sets bit e - 1.
+ */
+constexpr uint32_t tapMask(long a, long b, long c = 0, long d = 0) {
+  return (uint32_t(1) << (a - 1)) | (uint32_t(1) << (b - 1)) |
+         (c ? uint32_t(1) << (c - 1) : 0) | (d ? uint32_t(1) << (d - 1) : 0);
+}
+
+/**
+ * @brief Feedback taps for each supported MLS order, one bit per delay line
+ * cell, from a table of primitive polynomials (maximal-length LFSR taps,
+ * Xilinx XAPP052). Up to order 18 they are the taps of the original
+ * tapsTab[16][18] bool table (bit j of kTapMasks[N] is tapsTab[18 - N][j]),
+ * so those sequences are identical to the ones of the bit-serial generator.
+ * Orders without taps are unsupported.
+ */
+const long kMinMlsOrder = 3;
+const long kMaxMlsOrder = 24;
+constexpr uint32_t kTapMasks[kMaxMlsOrder + 1] = {
+    0, 0, 0,
+    tapMask(3, 2),              // 3
+    tapMask(4, 3),              // 4
+    tapMask(5, 3),              // 5
+    tapMask(6, 5),              // 6
+    tapMask(7, 4),              // 7
+    tapMask(8, 6, 5, 4),        // 8
+    tapMask(9, 5),              // 9
+    tapMask(10, 7),             // 10
+    tapMask(11, 9),             // 11
+    tapMask(12, 11, 8, 6),      // 12
+    tapMask(13, 12, 10, 9),     // 13
+    tapMask(14, 13, 8, 4),      // 14
+    tapMask(15, 14),            // 15
+    tapMask(16, 15, 13, 4),     // 16
+    tapMask(17, 14),            // 17
+    tapMask(18, 11),            // 18
+    tapMask(19, 6, 2, 1),       // 19
+    tapMask(20, 17),            // 20
+    tapMask(21, 19),            // 21
+    tapMask(22, 21),            // 22
+    tapMask(23, 18),            // 23
+    tapMask(24, 23, 22, 17)};   // 24
+
+/**
+ * @brief The feedback of order N must include the last cell of its delay
+ * line, and no cell past it.
+ */
+constexpr bool tapMasksValid(long N = kMinMlsOrder) {
+  return N > kMaxMlsOrder ||
+         ((kTapMasks[N] >> (N - 1)) == 1 && tapMasksValid(N + 1));
+}
+static_assert(tapMasksValid(), "kTapMasks: taps outside the delay line");
+
+/**
+ * @brief Whether MLSs of order N are supported.
+ */
+constexpr bool isSupportedMlsOrder(long N) {
+  return N >= kMinMlsOrder && N <= kMaxMlsOrder;
+}
+
+inline int parity64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_parityll(x);
+#else
+  x ^= x >> 32;
+  x ^= x >> 16;
+  x ^= x >> 8;
+  x ^= x >> 4;
+  x ^= x >> 2;
+  x ^= x >> 1;
+  return (int)(x & 1);
+#endif
+}
+
+/**
+ * @brief Number of 64 bit words needed to hold a packed sequence of P bits.
+ */
+inline long packedWords(long P) { return (P + 63) >> 6; }
+
+/**
+ * @brief Read 64 consecutive bits starting at bit position pos from a packed
+ * (LSB first) bitset. The word following the one holding pos must be valid
+ * whenever pos is not word aligned.
+ */
+inline uint64_t loadBits64(const uint64_t *words, long pos) {
+  const long idx = pos >> 6;
+  const int shift = (int)(pos & 63);
+  if (shift == 0) return words[idx];
+  return (words[idx] >> shift) | (words[idx + 1] << (64 - shift));
+}
+
+/**
+ * @brief Fibonacci linear feedback shift register held in a single machine
+ * word. Bit j of the state is cell j of the delay line, so the register can
+ * be stepped with one parity of (state & tapMask) instead of an N-wide
+ * multiply-accumulate.
+ */
+struct Lfsr {
+  long N;
+  uint64_t tapMask;
+  uint64_t state;
+
+  explicit Lfsr(long N)
+      : N(N), tapMask(kTapMasks[N]), state((uint64_t(1) << N) - 1) {}
+
+  /**
+   * @brief Shift the register once and return the output bit (the last cell
+   * of the delay line before the shift).
+   */
+  inline int step() {
+    const int out = (int)((state >> (N - 1)) & 1);
+    const uint64_t feedback = (uint64_t)parity64(state & tapMask);
+    state = ((state << 1) | feedback) & ((uint64_t(1) << N) - 1);
+    return out;
+  }
+};
+
+/**
+ * @brief Generate one period (P = 2^N - 1 bits) of the MLS of order N into a
+ * packed bitset of packedWords(P) words. Bit i of the sequence is stored in
+ * bit (i & 63) of words[i >> 6]; bits past P are cleared.
+ *
+ * The sequence obeys b[t] = XOR of b[t - L] over the tap lags L. Squaring the
+ * feedback polynomial k times gives b[t] = XOR of b[t - 2^k L], so once
+ * 2^k times the smallest lag reaches 64 every output word is a handful of
+ * unaligned 64 bit loads XORed together. Only the first 2^k N bits have to
+ * come from the bit-serial register.
+ */
+inline void generatePackedMls(long N, uint64_t *words) {
+  const long P = (1L << N) - 1;
+  const long nWords = packedWords(P);
+  const uint64_t tapMask = kTapMasks[N];
+  memset(words, 0, nWords * sizeof(uint64_t));
+
+  // tap lags (cell j feeds back with a delay of j + 1 samples)
+  long lags[kMaxMlsOrder];
+  long nLags = 0;
+  for (long j = 0; j < N; j++) {
+    if ((tapMask >> j) & 1) lags[nLags++] = j + 1;
+  }
+  long leap = 1;
+  while (leap * lags[0] < 64) leap <<= 1;
+
+  // bit-serial warm up, rounded up to whole words
+  long warmUp = ((leap * N + 63) >> 6) << 6;
+  if (warmUp > nWords * 64) warmUp = nWords * 64;
+  Lfsr lfsr(N);
+  for (long i = 0; i < warmUp; i++) {
+    words[i >> 6] |= (uint64_t)lfsr.step() << (i & 63);
+  }
+
+  // word-parallel body, 64 sequence bits per step
+  for (long w = warmUp >> 6; w < nWords; w++) {
+    const long t = w << 6;
+    uint64_t word = 0;
+    for (long l = 0; l < nLags; l++) word ^= loadBits64(words, t - leap * lags[l]);
+    words[w] = word;
+  }
+
+  if (P & 63) words[nWords - 1] &= (uint64_t(1) << (P & 63)) - 1;
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_LFSR_HPP_
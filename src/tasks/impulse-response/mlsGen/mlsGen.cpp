@@ -1,33 +1,79 @@
 #include "mlsGen.hpp"
+#include "mlsGenCApi.h"
+
+// The leak check binding only exists in sanitized (MEMORY_CHECKS) builds
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define MLSGEN_LEAK_CHECK 1
+#endif
+#endif
+#if !defined(MLSGEN_LEAK_CHECK) && defined(__SANITIZE_ADDRESS__)
+#define MLSGEN_LEAK_CHECK 1
+#endif
+#ifdef MLSGEN_LEAK_CHECK
 #include <sanitizer/lsan_interface.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-MLSGen::MLSGen(long N, long srcSR, long sinkSR) {
+MLSGen::MLSGen(long N, long srcSR, long sinkSR)
+    : MLSGen(N, srcSR, sinkSR, 1) {}
+
+MLSGen::MLSGen(long N, long srcSR, long sinkSR, long numThreads)
+    : MLSGen(N, srcSR, sinkSR, numThreads, kTagsAuto) {}
+
+MLSGen::MLSGen(long N, long srcSR, long sinkSR, long numThreads,
+               long tagStorage) {
+  if (!isSupportedMlsOrder(N)) {
+    throw std::invalid_argument("MLSGen: unsupported MLS order");
+  }
   MLSGen::N = N;
   MLSGen::srcSR = srcSR;
   MLSGen::sinkSR = sinkSR;
   P = (1 << N) - 1;
-  mls = new bool[P];
-  tagL = new long[P];
-  tagS = new long[P];
-  generatedSignal = new float[P];
-  recordedSignal = new float[P];
-  perm = new float[P + 1];
-  resp = new float[P + 1];
+  C = 0;
+  // owned here until the constructor can no longer throw
+  std::unique_ptr<ThreadPool> owned(numThreads > 1 ? new ThreadPool(numThreads)
+                                                   : nullptr);
+  pool = owned.get();
+  MLSGen::numThreads = poolSize(pool);  // 1 without pthreads in WASM
+  // cached: built once per order and tag storage
+  plan = MLSPlan::get(N, pool, resolveTagStorage(tagStorage, N));
+  MLSGen::tagStorage = plan->tagStorage;
+  onTheFly = onTheFlyKernel<float>(N);
+  mls = plan->mls();
+  // every working array in one block, in the order they are listed here
+  const long T = MLSGen::numThreads;
+  work = WorkArena(2 * WorkArena::bytesFor<float>(P) +
+                   WorkArena::bytesFor<float>(T * (P + 1)) +
+                   WorkArena::bytesFor<float>(P + 1) +
+                   WorkArena::bytesFor<float>(T * plan->fhtScratchFloat));
+  generatedSignal = work.take<float>(P);
+  recordedSignal = work.take<float>(P);
+  recordedSignals = nullptr;
+  hasRecording = false;
+  K = 0;
+  batchSignals = nullptr;
+  batchResps = nullptr;
+  perm = work.take<float>(T * (P + 1));
+  resp = work.take<float>(P + 1);
+  fhtScratch = work.take<float>(T * plan->fhtScratchFloat);
+  doublePrecision = false;
+  permDouble = nullptr;
+  fhtScratchDouble = nullptr;
+  onset = -1;
+  clockRatio = srcSR > 0 && sinkSR > 0 ? double(sinkSR) / srcSR : 1.0;
+  streamSkip = -1;
+  streamChange = -1;
+  owned.release();
 }
 
 #ifndef __EMSCRIPTEN__
 MLSGen::~MLSGen() {
-  delete[] mls;
-  delete[] tagL;
-  delete[] tagS;
-  delete[] generatedSignal;
-  delete[] recordedSignal;
-  delete[] perm;
-  delete[] resp;
+  plan.reset();
+  delete pool;
 }
 #endif
 
@@ -36,29 +82,23 @@ MLSGen::~MLSGen() {
 using namespace emscripten;
 
 void MLSGen::Destruct() {
-  delete[] mls;
-  delete[] tagL;
-  delete[] tagS;
-  delete[] generatedSignal;
-  delete[] recordedSignal;
-  delete[] perm;
-  delete[] resp;
+  plan.reset();
+  work.release();  // back to the pool for the next MLSGen
+  doubleWork.release();
+  delete pool;
+  pool = nullptr;  // a second Destruct must not free it again
+  stream.reset();
+  inputs.release();
 }
 
 emscripten::val MLSGen::getMLS() {
-  // if mls is not generated, generate it
-  if (*(&mls + 1) - mls != P) {
-    generateMls();
-  }
-  for (int i = 0; i < P; i++) {
-    generatedSignal[i] = -2 * mls[i] + 1;
-  }
-  return emscripten::val(typed_memory_view(P, generatedSignal));
+  return emscripten::val(typed_memory_view(P, mlsSignal()));
 }
 
 emscripten::val MLSGen::setRecordedSignalsMemoryView(long sizeRecordedSignals) {
   C = sizeRecordedSignals;
-  recordedSignals = new float[C];
+  recordedSignals = inputs.slot(kCaptureSlot, C);  // reused, grows as needed
+  hasRecording = false;
   return emscripten::val(typed_memory_view(C, recordedSignals));
 }
 
@@ -67,28 +107,571 @@ emscripten::val MLSGen::getRecordedSignalsMemoryView() {
 }
 
 emscripten::val MLSGen::getImpulseResponse() {
-  generateTagL();     // Generate tagL for the L matrix
-  generateTagS();     // Generate tagS for the S matrix
-  GenerateSignal();   // Generate the signal TEST PURPOSES
-  permuteSignal();    // Permute the signal according to tagS
-  fastHadamard();     // Do a Hadamard transform in place
-  permuteResponse();  // Permute the impulseresponse according to tagL
-  return emscripten::val(typed_memory_view(P + 1, resp));
+  return emscripten::val(typed_memory_view(P + 1, impulseResponse()));
+}
+
+double MLSGen::getRecordedSignalsOnset() {
+  return estimateOnset(recordedSignals, C);
+}
+
+double MLSGen::getRecordedSignalsClockRatio() {
+  return estimateClockRatio(recordedSignals, C);
+}
+
+long MLSGen::averageRecordedSignalsDriftCorrected(long numPeriods,
+                                                  double rejectThreshold) {
+  return averageDriftCorrected(recordedSignals, C, numPeriods,
+                               rejectThreshold);
+}
+
+long MLSGen::getInputArenaBytes() { return inputs.bytes(); }
+
+emscripten::val MLSGen::getStreamBlockMemoryView(long blockSize) {
+  float *block = inputs.slot(kStreamSlot, blockSize);
+  return emscripten::val(typed_memory_view(blockSize, block));
+}
+
+long MLSGen::pushStreamBlock(long n) {
+  return pushSamples(inputs.data(kStreamSlot), n);
+}
+
+emscripten::val MLSGen::getStreamImpulseResponse() {
+  return emscripten::val(typed_memory_view(P + 1, streamImpulseResponse()));
+}
+
+emscripten::val MLSGen::setBatchMemoryView(long numRecordings) {
+  K = numRecordings;
+  batchSignals = inputs.slot(kBatchSlot, K * P);
+  batchResps = inputs.slot(kBatchRespSlot, K * (P + 1));
+  return emscripten::val(typed_memory_view(K * P, batchSignals));
+}
+
+emscripten::val MLSGen::getImpulseResponses() {
+  impulseResponses(batchSignals, K, batchResps);  // K captures, one WASM call
+  return emscripten::val(typed_memory_view(K * (P + 1), batchResps));
+}
+
+long releaseCachedPlans() {
+  return MLSPlan::releaseUnused() + WelchPlan::releaseUnused() +
+         RealFftPlan::releaseUnused() + WorkArena::releaseUnused();
+}
+
+/**
+ * @brief A Float32Array copy of n floats, for results that do not outlive the
+ * call (unlike the memory views of an MLSGen).
+ */
+static val float32ArrayOf(const float *data, long n) {
+  return val::global("Float32Array").new_(typed_memory_view(n, data));
+}
+
+val getFrequencyResponse(val impulseResponse, double sampleRate) {
+  const std::vector<float> ir =
+      convertJSArrayToNumberVector<float>(impulseResponse);
+  const long bins = frequencyResponseBins((long)ir.size());
+  std::vector<float> frequencies(bins), gains(bins);
+  frequencyResponse(ir.data(), (long)ir.size(), sampleRate, frequencies.data(),
+                    gains.data());
+  val response = val::object();
+  response.set("frequencies", float32ArrayOf(frequencies.data(), bins));
+  response.set("gains", float32ArrayOf(gains.data(), bins));
+  response.set("gainAt1000Hz",
+               gainAtFrequency(frequencies.data(), gains.data(), bins, 1000));
+  return response;
+}
+
+val getImpulseResponseFromGains(val frequencies, val gains, double sampleRate,
+                                long length, long phase) {
+  const std::vector<float> hz =
+      convertJSArrayToNumberVector<float>(frequencies);
+  const std::vector<float> db = convertJSArrayToNumberVector<float>(gains);
+  const long count = (long)std::min(hz.size(), db.size());
+  if (count < 1 || length < 1) {
+    throw std::invalid_argument(
+        "getImpulseResponseFromGains: empty gain curve or length");
+  }
+  std::vector<float> ir(length);
+  impulseResponseFromGains(hz.data(), db.data(), count, sampleRate, length,
+                           phase == kMinimumPhase ? kMinimumPhase
+                                                  : kLinearPhase,
+                           ir.data());
+  return float32ArrayOf(ir.data(), length);
+}
+
+double getGainAtFrequency(val frequencies, val gains, double frequency) {
+  const std::vector<float> hz =
+      convertJSArrayToNumberVector<float>(frequencies);
+  const std::vector<float> db = convertJSArrayToNumberVector<float>(gains);
+  const long count = (long)std::min(hz.size(), db.size());
+  return count > 0 ? gainAtFrequency(hz.data(), db.data(), count, frequency)
+                   : 0;
+}
+
+val getPowerSpectralDensity(val signal, double sampleRate, long maxSegment,
+                            val knownFrequencies, val knownGains) {
+  const std::vector<float> x = convertJSArrayToNumberVector<float>(signal);
+  const std::vector<float> hz =
+      convertJSArrayToNumberVector<float>(knownFrequencies);
+  const std::vector<float> db = convertJSArrayToNumberVector<float>(knownGains);
+  if (x.empty()) {
+    throw std::invalid_argument("getPowerSpectralDensity: empty signal");
+  }
+  if (maxSegment <= 0) maxSegment = kMaxWelchSegment;
+  const long n = (long)x.size();
+  const long bins = welchBins(n, maxSegment);
+  std::vector<float> frequencies(bins), psd(bins);
+  welchPsd(x.data(), n, sampleRate, maxSegment, frequencies.data(),
+           psd.data());
+  subtractGainCurve(frequencies.data(), psd.data(), bins, hz.data(), db.data(),
+                    (long)std::min(hz.size(), db.size()));
+  val density = val::object();
+  density.set("frequencies", float32ArrayOf(frequencies.data(), bins));
+  density.set("psd", float32ArrayOf(psd.data(), bins));
+  return density;
+}
+
+val getInverseFilter(val impulseResponses, double sampleRate,
+                     val knownFrequencies, val knownGains, val options) {
+  const long count = impulseResponses["length"].as<long>();
+  std::vector<float> irs;
+  long n = 0;
+  for (long c = 0; c < count; c++) {
+    const std::vector<float> ir =
+        convertJSArrayToNumberVector<float>(impulseResponses[c]);
+    if (c == 0) n = (long)ir.size();
+    if ((long)ir.size() != n) {
+      throw std::invalid_argument("getInverseFilter: IRs of different lengths");
+    }
+    irs.insert(irs.end(), ir.begin(), ir.end());
+  }
+  const std::vector<float> hz =
+      convertJSArrayToNumberVector<float>(knownFrequencies);
+  const std::vector<float> db = convertJSArrayToNumberVector<float>(knownGains);
+  const InverseFilterOptions design = {
+      options["lowHz"].as<double>(),
+      options["highHz"].as<double>(),
+      options["regularizationDb"].as<double>(),
+      options["maxBoostDb"].as<double>(),
+      options["smoothOctaves"].as<double>(),
+      options["smoothMinBandwidthHz"].as<double>(),
+      options["length"].as<long>(),
+      options["phase"].as<long>() == kMinimumPhase ? kMinimumPhase
+                                                   : kLinearPhase};
+  if (count < 1 || n < 1 || design.length < 1) {
+    throw std::invalid_argument("getInverseFilter: no IR or empty length");
+  }
+  InverseFilter filter;
+  designInverseFilter(irs.data(), count, n, sampleRate, hz.data(), db.data(),
+                      (long)std::min(hz.size(), db.size()), design, filter);
+  const long bins = (long)filter.frequencies.size();
+  val result = val::object();
+  result.set("frequencies", float32ArrayOf(filter.frequencies.data(), bins));
+  result.set("gainsOrigin", float32ArrayOf(filter.gainsOrigin.data(), bins));
+  result.set("gains", float32ArrayOf(filter.gains.data(), bins));
+  result.set("angles", float32ArrayOf(filter.angles.data(), bins));
+  result.set("componentAngles",
+             float32ArrayOf(filter.componentAngles.data(), bins));
+  result.set("iir", float32ArrayOf(filter.iir.data(), design.length));
+  result.set("iirNoBandpass",
+             float32ArrayOf(filter.iirNoBandpass.data(), design.length));
+  result.set("attenuatorGainDb", filter.attenuatorGainDb);
+  result.set("fMaxHz", filter.fMaxHz);
+  return result;
+}
+
+val getLoopedConvolution(val signal, val ir, double gain, bool steadyState,
+                         long n) {
+  const std::vector<float> x = convertJSArrayToNumberVector<float>(signal);
+  const std::vector<float> h = convertJSArrayToNumberVector<float>(ir);
+  if (x.empty() || h.empty()) {
+    throw std::invalid_argument("getLoopedConvolution: empty signal or IR");
+  }
+  if (n <= 0) n = (long)x.size();  // one period
+  std::vector<float> y(n);
+  convolveLooped(x.data(), (long)x.size(), h.data(), (long)h.size(),
+                 (float)gain, steadyState, y.data(), n,
+                 kDefaultConvolutionBlock);
+  return float32ArrayOf(y.data(), n);
+}
+
+/**
+ * @brief A LoopedConvolution for javascript, handing out its output one
+ * block at a time so playback can start before the rest is computed.
+ */
+class ConvolutionStream {
+ public:
+  ConvolutionStream(val signal, val ir, double gain, bool steadyState) {
+    const std::vector<float> x = convertJSArrayToNumberVector<float>(signal);
+    const std::vector<float> h = convertJSArrayToNumberVector<float>(ir);
+    if (x.empty() || h.empty()) {
+      throw std::invalid_argument("ConvolutionStream: empty signal or IR");
+    }
+    looped.reset(new LoopedConvolution(x.data(), (long)x.size(), h.data(),
+                                       (long)h.size(), (float)gain,
+                                       steadyState, kDefaultConvolutionBlock));
+    block.resize(kDefaultConvolutionBlock);
+  }
+
+  long getBlockSize() const { return (long)block.size(); }
+
+  val nextBlock() {
+    looped->next(block.data(), (long)block.size());
+    return float32ArrayOf(block.data(), (long)block.size());
+  }
+
+ private:
+  std::unique_ptr<LoopedConvolution> looped;
+  std::vector<float> block;
+};
+
+emscripten::val MLSGen::getConvolvedMLS(val ir, double amplitude) {
+  const std::vector<float> h = convertJSArrayToNumberVector<float>(ir);
+  if (h.empty()) throw std::invalid_argument("getConvolvedMLS: empty IR");
+  std::vector<float> y(P);
+  convolveLooped(mlsSignal(), P, h.data(), (long)h.size(), (float)amplitude,
+                 true, y.data(), P, kDefaultConvolutionBlock);
+  return float32ArrayOf(y.data(), P);
 }
 
 // Binding code
 EMSCRIPTEN_BINDINGS(mls_gen_module) {
   class_<MLSGen>("MLSGen")
       .constructor<long, long, long>()
+      .constructor<long, long, long, long>()
+      .constructor<long, long, long, long, long>()
       .function("Destruct", &MLSGen::Destruct)
       .function("getMLS", &MLSGen::getMLS)
       .function("getRecordedSignalsMemoryView",
                 &MLSGen::getRecordedSignalsMemoryView)
+      .function("getInputArenaBytes", &MLSGen::getInputArenaBytes)
+      .function("getPlanBytes", &MLSGen::getPlanBytes)
       .function("setRecordedSignalsMemoryView",
                 &MLSGen::setRecordedSignalsMemoryView)
-      .function("getImpulseResponse", &MLSGen::getImpulseResponse);
+      .function("getImpulseResponse", &MLSGen::getImpulseResponse)
+      .function("setDoublePrecision", &MLSGen::setDoublePrecision)
+      .function("averageRecordedSignals", &MLSGen::averageRecordedSignals)
+      .function("getRecordedSignalsOnset", &MLSGen::getRecordedSignalsOnset)
+      .function("getRecordedSignalsClockRatio",
+                &MLSGen::getRecordedSignalsClockRatio)
+      .function("averageRecordedSignalsDriftCorrected",
+                &MLSGen::averageRecordedSignalsDriftCorrected)
+      .function("startStream", &MLSGen::startStream)
+      .function("getStreamBlockMemoryView", &MLSGen::getStreamBlockMemoryView)
+      .function("pushStreamBlock", &MLSGen::pushStreamBlock)
+      .function("getStreamImpulseResponse", &MLSGen::getStreamImpulseResponse)
+      .function("getStreamChange", &MLSGen::getStreamChange)
+      .function("setBatchMemoryView", &MLSGen::setBatchMemoryView)
+      .function("getImpulseResponses", &MLSGen::getImpulseResponses)
+      .function("getConvolvedMLS", &MLSGen::getConvolvedMLS);
+  class_<ConvolutionStream>("ConvolutionStream")
+      .constructor<val, val, double, bool>()
+      .function("getBlockSize", &ConvolutionStream::getBlockSize)
+      .function("nextBlock", &ConvolutionStream::nextBlock);
+  function("releaseCachedPlans", &releaseCachedPlans);
+  function("getFrequencyResponse", &getFrequencyResponse);
+  function("getImpulseResponseFromGains", &getImpulseResponseFromGains);
+  function("getGainAtFrequency", &getGainAtFrequency);
+  function("getPowerSpectralDensity", &getPowerSpectralDensity);
+  function("getInverseFilter", &getInverseFilter);
+  function("getLoopedConvolution", &getLoopedConvolution);
+  constant("linearPhase", (long)kLinearPhase);
+  constant("minimumPhase", (long)kMinimumPhase);
+  constant("defaultRegularizationDb", kDefaultRegularizationDb);
+  constant("minMlsOrder", kMinMlsOrder);
+  constant("maxMlsOrder", kMaxMlsOrder);
+#ifdef MLSGEN_LEAK_CHECK
   function("doLeakCheck", &__lsan_do_recoverable_leak_check);
+#endif
 };
+#else
+
+// C interface of the native build (mlsGenCApi.h). No exception may cross it:
+// every entry point that allocates catches them and returns its failure value.
+
+static MLSGen *mlsGenOf(mlsgen_t *gen) {
+  return reinterpret_cast<MLSGen *>(gen);
+}
+
+mlsgen_t *mlsgen_create(long N, long srcSR, long sinkSR, long numThreads) {
+  return mlsgen_create_with_tags(N, srcSR, sinkSR, numThreads,
+                                 MLSGEN_TAGS_AUTO);
+}
+
+mlsgen_t *mlsgen_create_with_tags(long N, long srcSR, long sinkSR,
+                                  long numThreads, int tagStorage) {
+  if (!isSupportedMlsOrder(N)) return nullptr;
+  try {
+    return reinterpret_cast<mlsgen_t *>(
+        new MLSGen(N, srcSR, sinkSR, numThreads, tagStorage));
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void mlsgen_destroy(mlsgen_t *gen) { delete mlsGenOf(gen); }
+
+long mlsgen_plan_bytes(const mlsgen_t *gen) {
+  return reinterpret_cast<const MLSGen *>(gen)->getPlanBytes();
+}
+
+long mlsgen_length(const mlsgen_t *gen) {
+  return reinterpret_cast<const MLSGen *>(gen)->getLength();
+}
+
+const float *mlsgen_mls(mlsgen_t *gen) { return mlsGenOf(gen)->mlsSignal(); }
+
+int mlsgen_set_double_precision(mlsgen_t *gen, int enabled) {
+  try {
+    mlsGenOf(gen)->setDoublePrecision(enabled != 0);
+    return 1;
+  } catch (...) {
+    return 0;
+  }
+}
+
+long mlsgen_average(mlsgen_t *gen, const float *capture, long length,
+                    long offset, long numPeriods, double rejectThreshold) {
+  try {
+    return mlsGenOf(gen)->averageCapture(capture, length, offset, numPeriods,
+                                         rejectThreshold);
+  } catch (...) {
+    return -1;
+  }
+}
+
+void mlsgen_set_recording(mlsgen_t *gen, const float *period) {
+  mlsGenOf(gen)->setRecordedSignal(period);
+}
+
+int mlsgen_impulse_response(mlsgen_t *gen, float *resp) {
+  try {
+    MLSGen *mlsGen = mlsGenOf(gen);
+    const float *ir = mlsGen->impulseResponse();
+    std::copy(ir, ir + mlsGen->getLength() + 1, resp);
+    return 1;
+  } catch (...) {
+    return 0;
+  }
+}
+
+int mlsgen_impulse_responses(mlsgen_t *gen, const float *signals, long K,
+                             float *resps) {
+  try {
+    mlsGenOf(gen)->impulseResponses(signals, K, resps);
+    return 1;
+  } catch (...) {
+    return 0;
+  }
+}
+
+double mlsgen_estimate_onset(mlsgen_t *gen, const float *capture,
+                             long length) {
+  try {
+    return mlsGenOf(gen)->estimateOnset(capture, length);
+  } catch (...) {
+    return -1;
+  }
+}
+
+double mlsgen_estimate_clock_ratio(mlsgen_t *gen, const float *capture,
+                                   long length) {
+  try {
+    return mlsGenOf(gen)->estimateClockRatio(capture, length);
+  } catch (...) {
+    return NAN;
+  }
+}
+
+long mlsgen_average_drift_corrected(mlsgen_t *gen, const float *capture,
+                                    long length, long numPeriods,
+                                    double rejectThreshold) {
+  try {
+    return mlsGenOf(gen)->averageDriftCorrected(capture, length, numPeriods,
+                                                rejectThreshold);
+  } catch (...) {
+    return -1;
+  }
+}
+
+int mlsgen_stream_start(mlsgen_t *gen, long offset) {
+  try {
+    mlsGenOf(gen)->startStream(offset);
+    return 1;
+  } catch (...) {
+    return 0;
+  }
+}
+
+long mlsgen_stream_push(mlsgen_t *gen, const float *block, long n) {
+  try {
+    return mlsGenOf(gen)->pushSamples(block, n);
+  } catch (...) {
+    return -1;
+  }
+}
+
+long mlsgen_stream_periods(const mlsgen_t *gen) {
+  return reinterpret_cast<const MLSGen *>(gen)->streamPeriods();
+}
+
+double mlsgen_stream_impulse_response(mlsgen_t *gen, float *resp) {
+  try {
+    MLSGen *mlsGen = mlsGenOf(gen);
+    const float *ir = mlsGen->streamImpulseResponse();
+    std::copy(ir, ir + mlsGen->getLength() + 1, resp);
+    return mlsGen->getStreamChange();
+  } catch (...) {
+    return NAN;
+  }
+}
+
+long mlsgen_frequency_response_bins(long n) {
+  return frequencyResponseBins(n);
+}
+
+long mlsgen_frequency_response(const float *ir, long n, double sampleRate,
+                               float *frequencies, float *gains) {
+  try {
+    frequencyResponse(ir, n, sampleRate, frequencies, gains);
+    return frequencyResponseBins(n);
+  } catch (...) {
+    return 0;
+  }
+}
+
+double mlsgen_gain_at_frequency(const float *frequencies, const float *gains,
+                                long count, double frequency) {
+  return gainAtFrequency(frequencies, gains, count, frequency);
+}
+
+int mlsgen_impulse_response_from_gains(const float *frequencies,
+                                       const float *gains, long count,
+                                       double sampleRate, long length,
+                                       int phase, float *ir) {
+  try {
+    impulseResponseFromGains(frequencies, gains, count, sampleRate, length,
+                             phase == MLSGEN_PHASE_MINIMUM ? kMinimumPhase
+                                                           : kLinearPhase,
+                             ir);
+    return 1;
+  } catch (...) {
+    return 0;
+  }
+}
+
+long mlsgen_psd_bins(long n, long maxSegment) {
+  return welchBins(n, maxSegment > 0 ? maxSegment : kMaxWelchSegment);
+}
+
+long mlsgen_psd(const float *x, long n, double sampleRate, long maxSegment,
+                float *frequencies, float *psd) {
+  if (n < 1) return 0;
+  try {
+    return welchPsd(x, n, sampleRate,
+                    maxSegment > 0 ? maxSegment : kMaxWelchSegment,
+                    frequencies, psd);
+  } catch (...) {
+    return 0;
+  }
+}
+
+void mlsgen_subtract_gains(const float *frequencies, float *psd, long bins,
+                           const float *knownFrequencies,
+                           const float *knownGains, long count) {
+  subtractGainCurve(frequencies, psd, bins, knownFrequencies, knownGains,
+                    count);
+}
+
+double mlsgen_inverse_filter(const float *irs, long count, long n,
+                             double sampleRate, const float *knownFrequencies,
+                             const float *knownGains, long knownCount,
+                             const mlsgen_inverse_filter_options *options,
+                             float *frequencies, float *gains, float *angles,
+                             float *componentAngles, float *iir,
+                             float *iirNoBandpass, double *fMaxHz) {
+  const InverseFilterOptions design = {
+      options->lowHz,
+      options->highHz,
+      options->regularizationDb,
+      options->maxBoostDb,
+      options->smoothOctaves,
+      options->smoothMinBandwidthHz,
+      options->length,
+      options->phase == MLSGEN_PHASE_MINIMUM ? kMinimumPhase : kLinearPhase};
+  InverseFilter filter;
+  try {
+    designInverseFilter(irs, count, n, sampleRate, knownFrequencies,
+                        knownGains, knownCount, design, filter);
+  } catch (...) {
+    return NAN;
+  }
+  std::copy(filter.frequencies.begin(), filter.frequencies.end(), frequencies);
+  std::copy(filter.gains.begin(), filter.gains.end(), gains);
+  if (angles) std::copy(filter.angles.begin(), filter.angles.end(), angles);
+  if (componentAngles) {
+    std::copy(filter.componentAngles.begin(), filter.componentAngles.end(),
+              componentAngles);
+  }
+  std::copy(filter.iir.begin(), filter.iir.end(), iir);
+  std::copy(filter.iirNoBandpass.begin(), filter.iirNoBandpass.end(),
+            iirNoBandpass);
+  if (fMaxHz) *fMaxHz = filter.fMaxHz;
+  return filter.attenuatorGainDb;
+}
+
+static PartitionedConvolver *convolverOf(mlsgen_convolver_t *convolver) {
+  return reinterpret_cast<PartitionedConvolver *>(convolver);
+}
+
+mlsgen_convolver_t *mlsgen_convolver_create(const float *h, long length,
+                                            long block, int nonUniform) {
+  if (block <= 0) block = kDefaultConvolutionBlock;
+  if (length < 1 || block > kMaxConvolutionBlock || nextPowerOfTwo(block) != block) {
+    return nullptr;
+  }
+  try {
+    return reinterpret_cast<mlsgen_convolver_t *>(
+        new PartitionedConvolver(h, length, block, nonUniform != 0));
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+long mlsgen_convolver_block(const mlsgen_convolver_t *convolver) {
+  return reinterpret_cast<const PartitionedConvolver *>(convolver)
+      ->getBlockSize();
+}
+
+void mlsgen_convolver_process(mlsgen_convolver_t *convolver, const float *in,
+                              float *out) {
+  convolverOf(convolver)->process(in, out);
+}
+
+void mlsgen_convolver_reset(mlsgen_convolver_t *convolver) {
+  convolverOf(convolver)->reset();
+}
+
+void mlsgen_convolver_destroy(mlsgen_convolver_t *convolver) {
+  delete convolverOf(convolver);
+}
+
+int mlsgen_convolve_looped(const float *x, long period, const float *h,
+                           long length, float gain, int steadyState, float *y,
+                           long n) {
+  if (period < 1 || length < 1) return 0;
+  try {
+    convolveLooped(x, period, h, length, gain, steadyState != 0, y, n,
+                   kDefaultConvolutionBlock);
+    return 1;
+  } catch (...) {
+    return 0;
+  }
+}
+
+long mlsgen_release_cached_plans(void) {
+  return MLSPlan::releaseUnused() + WelchPlan::releaseUnused() +
+         RealFftPlan::releaseUnused() + WorkArena::releaseUnused();
+}
+
 #endif
 
 #ifdef __cplusplus
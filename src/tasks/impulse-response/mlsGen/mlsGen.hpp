@@ -8,7 +8,25 @@
 #include <emscripten/val.h>
 #endif
 
-#include "kiss_fft.h"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "averaging.hpp"
+#include "convolution.hpp"
+#include "correlation.hpp"
+#include "deconvolution.hpp"
+#include "frequencyResponse.hpp"
+#include "hadamard.hpp"
+#include "inputArena.hpp"
+#include "inverseFilter.hpp"
+#include "mlsGenT.hpp"
+#include "mlsPlan.hpp"
+#include "psd.hpp"
+#include "resampler.hpp"
+#include "simd.hpp"
+#include "threadPool.hpp"
+#include "workArena.hpp"
 
 /**
  * @brief Exposes methods for generating an MLS signal, and calculating the
@@ -27,42 +45,134 @@ class MLSGen {
   long srcSR;
   long sinkSR;
 
-  // MLS data
-  bool *mls;
-  long *tagL;
-  long *tagS;
+  // Onset alignment
+  std::vector<float> correlation; // capture x MLS cross-correlation, per lag
+  double onset; // sub-sample onset of the first period, -1 if unknown
+
+  // Clock drift correction
+  double clockRatio; // capture samples per MLS sample, sinkSR / srcSR ideally
+  std::vector<float> resampled; // capture resampled onto the MLS clock
+
+  // Streaming input, see startStream
+  std::unique_ptr<PeriodAccumulator> stream;
+  long streamSkip; // samples to drop before the first period, -1 for auto
+  std::vector<float> streamPending; // stream head held to find the onset
+  std::vector<float> previousResp; // last streamed impulse response
+  double streamChange; // relative change of the last streamed response
+
+  // MLS data, shared with every MLSGen of the same order
+  std::shared_ptr<const MLSPlan> plan;
+  const uint64_t *mls;  // packed MLS bits, LSB first
+  TagStorage tagStorage; // tag tables of the plan (16/32 bit or none)
+  OnTheFlyKernel<float> onTheFly; // table-free deconvolution of this order
   float *generatedSignal;  // MLS signal at +- 1
 
+  // Working arrays, carved from one pooled 64-byte aligned block
+  WorkArena work;
+
   // IR data
   float *recordedSignal; // isolated mls signal
-  float *recordedSignals; // full capture
-  float *perm; // permutation of recorded signals
+  float *recordedSignals; // full capture, kCaptureSlot of inputs
+  bool hasRecording; // recordedSignal holds an averaged capture
+  float *perm; // permutation of recorded signals, one 2^N buffer per thread
   float *resp; // impulse response of recorded signals
- 
+  float *fhtScratch; // column strips of the blocked Hadamard transform, per thread
+
+  // Threads sharing the deconvolution, nullptr when single threaded
+  long numThreads;
+  ThreadPool *pool;
+
+  // Batch data, allocated by setBatchMemoryView
+  long K; // number of recordings in the batch
+  float *batchSignals; // K periods of P samples back to back, kBatchSlot
+  float *batchResps; // K impulse responses of P + 1 samples, kBatchRespSlot
+
+  // Double precision accumulator, its own arena allocated on demand
+  bool doublePrecision;
+  WorkArena doubleWork;
+  double *permDouble;
+  double *fhtScratchDouble;
+
+  // Buffers shared with javascript, reused across captures
+  static const long kCaptureSlot = 0;
+  static const long kBatchSlot = 1;
+  static const long kStreamSlot = 2;
+  static const long kBatchRespSlot = 3;
+  InputArena inputs;
 
   // Internals
   void GenerateSignal();
-  void generateMls();
   void fastHadamard();
   void permuteSignal();
   void permuteResponse();
-  void generateTagL();
-  void generateTagS();
-  void estimateDiff();
-  void computeCorrelation();
-  void computeFilter();
+  void deconvolve();
+  void estimateDiff(const float *capture, long length);
+  void computeCorrelation(const float *capture, long length);
+  template <typename T>
+  void permuteSignalInto(T *work);
+  template <typename T>
+  void permuteResponseFrom(const T *work);
+  template <typename T>
+  void deconvolveWith(const float *signal, T *work, T *scratch, float *out);
+  template <typename T>
+  void deconvolveBatchWith(const float *signals, long K, T *work, T *scratch,
+                           float *outs);
+  OnTheFlyKernel<float> onTheFlyKernelFor(const float *) const {
+    return onTheFly;
+  }
+  OnTheFlyKernel<double> onTheFlyKernelFor(const double *) const {
+    return &deconvolveMlsOnTheFly<double, RuntimeMlsOrder>;
+  }
 
  public:
   /**
    * @brief Construct a new MLSGen object with the given factor and
    * sampling frequencies.
    *
-   * @param N - number of bits
+   * @param N - number of bits, kMinMlsOrder to kMaxMlsOrder (3 to 24)
    * @param srcSR - source sampling frequency
    * @param sinkSR - sink sampling frequency
    */
   MLSGen(long N, long srcSR, long sinkSR);
 
+  /**
+   * @brief Construct a new MLSGen object that spreads the Hadamard transform,
+   * the permutation tables and batched captures over numThreads threads. The
+   * impulse responses are the same as with one thread. In a WASM build
+   * without pthreads this falls back to a single thread.
+   *
+   * @param N - number of bits
+   * @param srcSR - source sampling frequency
+   * @param sinkSR - sink sampling frequency
+   * @param numThreads - number of threads, <= 1 for single threaded
+   */
+  MLSGen(long N, long srcSR, long sinkSR, long numThreads);
+
+  /**
+   * @brief Construct a new MLSGen object with a choice of tag tables: 16 or
+   * 32 bit tables, the smallest that fits by default, or none at all
+   * (kTagsOnTheFly), where the tags are regenerated from the sequence during
+   * each permutation. Without tables the plan of order N is the 2^N / 8
+   * bytes of the packed sequence instead of two tables of 2^N indices, at the
+   * cost of a slower deconvolution.
+   *
+   * @param N - number of bits
+   * @param srcSR - source sampling frequency
+   * @param sinkSR - sink sampling frequency
+   * @param numThreads - number of threads, <= 1 for single threaded
+   * @param tagStorage - a TagStorage value
+   * @throws std::invalid_argument - N outside kMinMlsOrder to kMaxMlsOrder
+   */
+  MLSGen(long N, long srcSR, long sinkSR, long numThreads, long tagStorage);
+
+  /**
+   * @brief Bytes of the MLS plan (sequence and tag tables) this engine uses,
+   * shared with every engine of the same order and tag storage.
+   *
+   * @return long
+   */
+  long getPlanBytes() const { return plan->tableBytes(); }
+
 #ifndef __EMSCRIPTEN__
   /**
    * @brief Destruct the MLSGen object.
@@ -96,6 +206,65 @@ class MLSGen {
 
   emscripten::val getRecordedSignalsMemoryView();
 
+  /**
+   * @brief Bytes held by the input buffers (capture, batch and stream
+   * block) that are reused across captures.
+   *
+   * @return long
+   */
+  long getInputArenaBytes();
+
+  /**
+   * @brief Onset of the first complete MLS period in the recorded signals,
+   * in (fractional) samples. See estimateOnset.
+   *
+   * @return double
+   */
+  double getRecordedSignalsOnset();
+
+  /**
+   * @brief Clock ratio of the recorded signals. See estimateClockRatio.
+   *
+   * @return double
+   */
+  double getRecordedSignalsClockRatio();
+
+  /**
+   * @brief Average the recorded signals after correcting the clock drift.
+   * See averageDriftCorrected.
+   *
+   * @return long - number of periods kept
+   */
+  long averageRecordedSignalsDriftCorrected(long numPeriods,
+                                            double rejectThreshold);
+
+  /**
+   * @brief Get a memory view of at least blockSize samples for the
+   * javascript code to write the next streamed block into, then call
+   * pushStreamBlock. Fetch the view again for every block: it moves if the
+   * WASM memory grows.
+   *
+   * @param blockSize - number of samples in the next block
+   * @return emscripten::val
+   */
+  emscripten::val getStreamBlockMemoryView(long blockSize);
+
+  /**
+   * @brief Push the first n samples of the stream block view. See
+   * pushSamples.
+   *
+   * @return long - number of periods completed by this block
+   */
+  long pushStreamBlock(long n);
+
+  /**
+   * @brief Impulse response of the stream so far. See
+   * streamImpulseResponse.
+   *
+   * @return emscripten::val
+   */
+  emscripten::val getStreamImpulseResponse();
+
   /**
    * @brief Get the Impulse Response. Returns a memory view of the impulse
    * response.
@@ -103,7 +272,194 @@ class MLSGen {
    * @return emscripten::val
    */
   emscripten::val getImpulseResponse();
+
+  /**
+   * @brief Allocate room for a batch of recordings and return a memory view
+   * of it (numRecordings periods of P samples back to back) for the
+   * javascript code to fill.
+   *
+   * @param numRecordings - number of recordings in the batch
+   * @return emscripten::val
+   */
+  emscripten::val setBatchMemoryView(long numRecordings);
+
+  /**
+   * @brief Deconvolve every recording of the batch in one call, sharing the
+   * permutation tables and working buffers. Returns a memory view of the
+   * impulse responses (P + 1 samples each, back to back).
+   *
+   * @return emscripten::val
+   */
+  emscripten::val getImpulseResponses();
+
+  /**
+   * @brief The MLS as it plays in a loop through a filter, once settled: one
+   * period of its circular convolution with ir, times amplitude, computed by
+   * partitioned FFT convolution.
+   *
+   * @param ir - the filter, e.g. an inverse impulse response
+   * @param amplitude - gain of the MLS
+   * @return emscripten::val - a Float32Array of P samples
+   */
+  emscripten::val getConvolvedMLS(emscripten::val ir, double amplitude);
 #endif
+
+  /**
+   * @brief Length of the MLS (P samples per period).
+   */
+  long getLength() const { return P; }
+
+  /**
+   * @brief Expand the MLS to samples at +- 1 and return them (P samples,
+   * owned by this object).
+   *
+   * @return const float*
+   */
+  const float *mlsSignal();
+
+  /**
+   * @brief Use one period of P samples, already isolated and averaged, as
+   * the recording getImpulseResponse deconvolves.
+   *
+   * @param period - P samples
+   */
+  void setRecordedSignal(const float *period);
+
+  /**
+   * @brief Deconvolve the recording (simulated when none was set) and return
+   * the impulse response (P + 1 samples, owned by this object).
+   *
+   * @return const float*
+   */
+  const float *impulseResponse();
+
+  /**
+   * @brief Deconvolve K recordings of one period each, back to back, into K
+   * impulse responses of P + 1 samples.
+   *
+   * @param signals - K * P samples
+   * @param K - number of recordings
+   * @param resps - K * (P + 1) samples
+   */
+  void impulseResponses(const float *signals, long K, float *resps);
+
+  /**
+   * @brief Average the periods of a raw capture into the recording that
+   * impulseResponse deconvolves, optionally rejecting outlier periods.
+   *
+   * @param capture - length samples
+   * @param length - number of samples in the capture
+   * @param offset - index of the first sample of the first period
+   * @param numPeriods - number of periods to average, clamped to the capture
+   * @param rejectThreshold - drop periods whose squared distance to the mean
+   * exceeds this multiple of the median distance, <= 0 to keep all
+   * @return long - number of periods kept
+   */
+  long averageCapture(const float *capture, long length, long offset,
+                      long numPeriods, double rejectThreshold);
+
+  /**
+   * @brief Find where the first complete MLS period starts in a raw capture,
+   * from the peak of its FFT cross-correlation with the MLS, refined to a
+   * fraction of a sample.
+   *
+   * @param capture - length samples
+   * @param length - number of samples in the capture
+   * @return double - onset in samples, -1 when the capture is shorter than P
+   */
+  double estimateOnset(const float *capture, long length);
+
+  /**
+   * @brief Estimate the ratio between the sink and source clocks as seen in
+   * a capture of several periods: capture samples per MLS sample, nominally
+   * sinkSR / srcSR. The capture is first resampled by the nominal ratio when
+   * the rates differ, and the residual drift comes from the spacing of the
+   * correlation peaks of consecutive periods.
+   *
+   * @param capture - length samples
+   * @param length - number of samples in the capture
+   * @return double - capture samples per MLS sample
+   */
+  double estimateClockRatio(const float *capture, long length);
+
+  /**
+   * @brief Like averageCapture, but first resample the capture onto the MLS
+   * clock (windowed-sinc, ratio from estimateClockRatio) starting at the
+   * sub-sample onset of the first period, so every period is exactly P
+   * samples before averaging.
+   *
+   * @param capture - length samples
+   * @param length - number of samples in the capture
+   * @param numPeriods - number of periods to average, clamped to the capture
+   * @param rejectThreshold - outlier threshold, <= 0 to keep all periods
+   * @return long - number of periods kept
+   */
+  long averageDriftCorrected(const float *capture, long length,
+                             long numPeriods, double rejectThreshold);
+
+  /**
+   * @brief Start (or restart) a streamed recording: samples then arrive in
+   * blocks of any size through pushSamples and are summed period by period,
+   * so memory stays at about one period whatever the recording length.
+   *
+   * @param offset - samples to drop before the first period, or -1 to find
+   * the onset from the first two periods of the stream (the MLS must then
+   * start less than one period into the stream)
+   */
+  void startStream(long offset);
+
+  /**
+   * @brief Add a block of the streamed recording.
+   *
+   * @param block - n samples
+   * @param n - number of samples
+   * @return long - number of periods completed by this block
+   */
+  long pushSamples(const float *block, long n);
+
+  /**
+   * @brief Number of complete periods streamed so far.
+   */
+  long streamPeriods() const { return stream ? stream->periods() : 0; }
+
+  /**
+   * @brief Deconvolve the running average of the stream and return the
+   * impulse response (P + 1 samples, owned by this object). Also updates
+   * getStreamChange.
+   *
+   * @return const float*
+   */
+  const float *streamImpulseResponse();
+
+  /**
+   * @brief Energy of the difference between the last two streamed impulse
+   * responses relative to the energy of the last one, to stop a recording
+   * once the estimate has converged. -1 before the second response.
+   */
+  double getStreamChange() const { return streamChange; }
+
+  /**
+   * @brief Run the permutation and Hadamard transform with a double
+   * precision accumulator instead of float. Costs twice the working memory
+   * but keeps the impulse response tail accurate at large orders.
+   *
+   * @param enabled - true for double, false for float (default)
+   */
+  void setDoublePrecision(bool enabled);
+
+  /**
+   * @brief Average the periods of the raw capture (set through
+   * setRecordedSignalsMemoryView) into the single period that
+   * getImpulseResponse deconvolves, optionally rejecting outlier periods.
+   *
+   * @param offset - index of the first sample of the first period
+   * @param numPeriods - number of periods to average, clamped to the capture
+   * @param rejectThreshold - drop periods whose squared distance to the mean
+   * exceeds this multiple of the median distance, <= 0 to keep all
+   * @return long - number of periods kept
+   */
+  long averageRecordedSignals(long offset, long numPeriods,
+                              double rejectThreshold);
 };
 
 void MLSGen::GenerateSignal() {
@@ -119,186 +475,252 @@ void MLSGen::GenerateSignal() {
   }
 }
 
-void MLSGen::generateMls() {
-  const long maxNoTaps = 18;
-  const bool tapsTab[16][18] = {
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0,
-      1, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0,
-      0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 1, 1, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, 1, 1,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0,
-      0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 1, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-  bool taps[maxNoTaps];
-  long i, j;
-  bool *delayLine = new bool[maxNoTaps];
-  long sum;
-  for (i = 0; i < N; i++)  // copy the N’th taps table
-  {
-    taps[i] = tapsTab[maxNoTaps - N][i];
-    delayLine[i] = 1;
+void MLSGen::fastHadamard() {
+  if (doublePrecision) {
+    fastHadamardTransform(permDouble, N, fhtScratchDouble, pool);
+  } else {
+    fastHadamardTransform(perm, N, fhtScratch, pool);
   }
-  for (i = 0; i < P; i++)  // Generate an MLS by summing the taps mod 2
-  {
-    sum = 0;
-    for (j = 0; j < N; j++) {
-      sum += taps[j] * delayLine[j];
-    }
-    sum &= 1;  // mod 2
-    mls[i] = delayLine[N - 1];
-    for (j = N - 2; j >= 0; j--) {
-      delayLine[j + 1] = delayLine[j];
-    }
-    delayLine[0] = *(bool *)&sum;
+}
+
+template <typename T>
+void MLSGen::permuteSignalInto(T *work) {
+  if (tagStorage == kTagsUint16) {
+    permuteSignalByTagS(recordedSignal, plan->tagSInv<uint16_t>(), P, work);
+  } else if (tagStorage == kTagsUint32) {
+    permuteSignalByTagS(recordedSignal, plan->tagSInv<uint32_t>(), P, work);
+  } else {
+    permuteSignalByMls(recordedSignal, mls, plan->unitTags(), N, work);
   }
-  delete[] delayLine;
 }
 
-void MLSGen::fastHadamard() {
-  long i, i1, j, k, k1, k2, P1;
-  double temp;
-  P1 = P + 1;
-  k1 = P1;
-  for (k = 0; k < N; k++) {
-    k2 = k1 >> 1;
-    for (j = 0; j < k2; j++) {
-      for (i = j; i < P1; i = i + k1) {
-        i1 = i + k2;
-        temp = perm[i] + perm[i1];
-        perm[i1] = perm[i] - perm[i1];
-        perm[i] = temp;
-      }
+template <typename T>
+void MLSGen::permuteResponseFrom(const T *work) {
+  if (tagStorage == kTagsUint16) {
+    permuteResponseByTagL(work, plan->tagLInv<uint16_t>(), P, resp);
+  } else if (tagStorage == kTagsUint32) {
+    permuteResponseByTagL(work, plan->tagLInv<uint32_t>(), P, resp);
+  } else {
+    permuteResponseByMls(work, mls, plan->unitTags(), N, resp);
+  }
+}
+
+template <typename T>
+void MLSGen::deconvolveWith(const float *signal, T *work, T *scratch,
+                            float *out) {
+  if (tagStorage == kTagsUint16) {
+    deconvolveMls(signal, plan->tagSInv<uint16_t>(), plan->tagLInv<uint16_t>(),
+                  N, work, scratch, out, pool);
+  } else if (tagStorage == kTagsUint32) {
+    deconvolveMls(signal, plan->tagSInv<uint32_t>(), plan->tagLInv<uint32_t>(),
+                  N, work, scratch, out, pool);
+  } else {
+    onTheFlyKernelFor(work)(signal, mls, plan->unitTags(), N, work, scratch,
+                            out, pool);
+  }
+}
+
+template <typename T>
+void MLSGen::deconvolveBatchWith(const float *signals, long K, T *work,
+                                 T *scratch, float *outs) {
+  if (tagStorage == kTagsUint16) {
+    deconvolveMlsBatch(signals, K, plan->tagSInv<uint16_t>(),
+                       plan->tagLInv<uint16_t>(), N, work, scratch, outs,
+                       pool);
+  } else if (tagStorage == kTagsUint32) {
+    deconvolveMlsBatch(signals, K, plan->tagSInv<uint32_t>(),
+                       plan->tagLInv<uint32_t>(), N, work, scratch, outs,
+                       pool);
+  } else {
+    // one capture at a time, each spread over the pool
+    for (long c = 0; c < K; c++) {
+      deconvolveWith(signals + c * P, work, scratch, outs + c * (P + 1));
     }
-    k1 = k1 >> 1;
   }
 }
 
 void MLSGen::permuteSignal() {
-  long i;
-  double dc = 0;
-  for (i = 0; i < P; i++) dc += recordedSignal[i];
-  perm[0] = -dc;
-  for (i = 0; i < P; i++)  // Just a permutation of the measured signal
-    perm[tagS[i]] = recordedSignal[i];
+  if (doublePrecision) {
+    permuteSignalInto(permDouble);
+  } else {
+    permuteSignalInto(perm);
+  }
 }
 
 void MLSGen::permuteResponse() {
-  long i;
-  const double fact = 1 / double(P + 1);
-  for (i = 0; i < P; i++)  // Just a permutation of the impulse response
-  {
-    resp[i] = perm[tagL[i]] * fact;
+  if (doublePrecision) {
+    permuteResponseFrom(permDouble);
+  } else {
+    permuteResponseFrom(perm);
   }
-  resp[P] = 0;
 }
 
-void MLSGen::generateTagL() {
-  long i, j;
-  long *colSum = new long[P];
-  long *index = new long[N];
-  for (i = 0; i < P; i++)  // Run through all the columns in the autocorr matrix
-  {
-    colSum[i] = 0;
-    for (j = 0; j < N; j++)  // Find colSum as the value of the first N elements
-                             // regarded as a binary number
-    {
-      colSum[i] += mls[(P + i - j) % P] << (N - 1 - j);
-    }
-    for (j = 0; j < N; j++)  // Figure out if colSum is a 2^j number and store
-                             // the column as the j’th index
-    {
-      if (colSum[i] == (1 << j)) index[j] = i;
-    }
+void MLSGen::deconvolve() {
+  if (doublePrecision) {
+    deconvolveWith(recordedSignal, permDouble, fhtScratchDouble, resp);
+  } else {
+    deconvolveWith(recordedSignal, perm, fhtScratch, resp);
   }
-  for (i = 0; i < P; i++)  // For each row in the L matrix
-  {
-    tagL[i] = 0;
-    for (j = 0; j < N; j++)  // Find the tagL as the value of the rows in the L
-                             // matrix regarded as a binary number
-    {
-      tagL[i] += mls[(P + index[j] - i) % P] * (1 << j);
-    }
+}
+
+const float *MLSGen::mlsSignal() {
+  expandBitsToSigns(mls, generatedSignal, P);  // -2 * mls[i] + 1
+  return generatedSignal;
+}
+
+void MLSGen::setRecordedSignal(const float *period) {
+  std::copy(period, period + P, recordedSignal);
+  hasRecording = true;
+}
+
+const float *MLSGen::impulseResponse() {
+  if (!hasRecording) {
+    GenerateSignal();  // No capture averaged, simulate one TEST PURPOSES
   }
-  delete[] colSum;
-  delete[] index;
+  deconvolve();  // Permute by tagS, Hadamard transform, permute by tagL
+  return resp;
 }
 
-void MLSGen::generateTagS() {
-  long i, j;
-  for (i = 0; i < P; i++)  // For each column in the S matrix
-  {
-    tagS[i] = 0;
-    for (j = 0; j < N; j++)  // Find the tagS as the value of the columns in the
-                             // S matrix regarded as a binary number
-    {
-      tagS[i] += mls[(P + i - j) % P] * (1 << (N - 1 - j));
-    }
+void MLSGen::impulseResponses(const float *signals, long K, float *resps) {
+  if (doublePrecision) {
+    deconvolveBatchWith(signals, K, permDouble, fhtScratchDouble, resps);
+  } else {
+    deconvolveBatchWith(signals, K, perm, fhtScratch, resps);
   }
 }
 
-  // #compute_correlation = (recorded, generated, P) => {
-
-  //   // cross correlate to find the best match
-  //   size = len(v) * len(generated);
-  //   const fftr2r_x = new fftw.r2r.fft1d(size);
-  //   const xCorr = fftr2r_x.backward(
-  //     fftr2r_x.forward(v - v_avg) * fftr2r_x.forward(g_reversed - g_avg)
-  //   );
-  //   fftr2r_x.dispose(); // manual garbage collection
-  //   const lag = this.#argMax(xCorr) - Math.floor(v.length / 2);
-
-  //   // auto correlate to find the sampling difference
-  //   size = len(v) * len(v);
-  //   const fftr2r_auto = new fftw.r2r.fft1d(size);
-  //   const autoCorr_full = fftr2r_auto.backward(
-  //     fftr2r_auto.forward(v) * fftr2r_auto.forward(v_reversed)
-  //   );
-  //   const autoCorr = autoCorr_full.slice(len(autoCorr_full) - len(v), len(autoCorr_full));
-  //   const inflection = this.#npdiff(Math.sign(this.#npdiff(autoCorr)));
-  //   const peaks = inflection.map((x, i) => (x < 0 ? 1 : 0));
-  // };
-
-void MLSGen::computeCorrelation() {
-  // inverse FFT of size C
-  kiss_fft_cfg xcor_cfg = kiss_fft_alloc(C,1,0,0 );
-  kiss_fft_cpx *xcor_in = new kiss_fft_cpx[C];
-  kiss_fft_cpx *xcor_out = new kiss_fft_cpx[C];
-
-  // set up input and output arrays
-  for(int i = 0; i < C; i++) {
-    xcor_in[i].r = recordedSignals[i];
-    xcor_in[i].i = 0;
+long MLSGen::averageCapture(const float *capture, long length, long offset,
+                            long numPeriods, double rejectThreshold) {
+  if (capture == nullptr || offset < 0 || offset >= length) return 0;
+  const long available = (length - offset) / P;
+  if (numPeriods > available) numPeriods = available;
+  const long kept = averagePeriods(capture + offset, P, numPeriods,
+                                   rejectThreshold, recordedSignal);
+  hasRecording = kept > 0;
+  return kept;
+}
+
+void MLSGen::startStream(long offset) {
+  if (stream) {
+    stream->reset();
+  } else {
+    stream.reset(new PeriodAccumulator(P));
   }
+  streamSkip = offset < 0 ? -1 : offset;
+  streamPending.clear();
+  previousResp.clear();
+  streamChange = -1;
+}
+
+long MLSGen::pushSamples(const float *block, long n) {
+  if (!stream) startStream(-1);
+  if (streamSkip < 0) {
+    // hold the head of the stream until it surely holds a whole period
+    streamPending.insert(streamPending.end(), block, block + n);
+    if ((long)streamPending.size() < 2 * P) return 0;
+    std::vector<float> head;
+    head.swap(streamPending);
+    const long start =
+        (long)floor(estimateOnset(head.data(), (long)head.size()) + 0.5);
+    std::vector<float>().swap(correlation);
+    streamSkip = 0;
+    return pushSamples(head.data() + start, (long)head.size() - start);
+  }
+  const long drop = std::min(n, streamSkip);
+  streamSkip -= drop;
+  return stream->push(block + drop, n - drop);
+}
 
-  // compute iFFT
-  kiss_fft( xcor_cfg , xcor_in , xcor_out );
-  // free memory
-  kiss_fft_free(xcor_cfg);
-
-  // find max index
-  int max_index = 0;
-  double max_value = 0;
-  for(int i = 0; i < C; i++) {
-    if(xcor_out[i].r > max_value) {
-      max_index = i;
-      max_value = xcor_out[i].r;
+const float *MLSGen::streamImpulseResponse() {
+  if (!stream) return impulseResponse();
+  stream->average(recordedSignal);
+  hasRecording = true;
+  deconvolve();
+  if (!previousResp.empty()) {
+    double difference = 0, energy = 0;
+    for (long i = 0; i <= P; i++) {
+      const double d = resp[i] - previousResp[i];
+      difference += d * d;
+      energy += double(resp[i]) * resp[i];
     }
+    streamChange = energy > 0 ? difference / energy : -1;
   }
+  previousResp.assign(resp, resp + P + 1);
+  return resp;
+}
+
+long MLSGen::averageRecordedSignals(long offset, long numPeriods,
+                                    double rejectThreshold) {
+  return averageCapture(recordedSignals, C, offset, numPeriods,
+                        rejectThreshold);
+}
 
-  // use max index to compute lag
-  int lag = max_index - C/2;
+void MLSGen::setDoublePrecision(bool enabled) {
+  doublePrecision = enabled;
+  if (enabled && permDouble == nullptr) {
+    const long permCount = numThreads * (P + 1);
+    const long scratchCount = numThreads * plan->fhtScratchDouble;
+    doubleWork = WorkArena(WorkArena::bytesFor<double>(permCount) +
+                           WorkArena::bytesFor<double>(scratchCount));
+    permDouble = doubleWork.take<double>(permCount);
+    fhtScratchDouble = doubleWork.take<double>(scratchCount);
+  }
+}
 
+void MLSGen::computeCorrelation(const float *capture, long length) {
+  correlation.assign(length >= P ? length - P + 1 : 0, 0.0f);
+  onset = estimateMlsOnset(capture, length, mlsSignal(), P,
+                           correlation.data());
+}
 
+double MLSGen::estimateOnset(const float *capture, long length) {
+  computeCorrelation(capture, length);
+  return onset;
 }
 
-void MLSGen::computeFilter() {
+void MLSGen::estimateDiff(const float *capture, long length) {
+  const double nominal =
+      srcSR > 0 && sinkSR > 0 ? double(sinkSR) / double(srcSR) : 1.0;
+  // A drifting period smears its correlation peak over a few lags, so the
+  // ratio is refined on captures resampled by the estimate so far, where
+  // the residual drift (and smear) is much smaller.
+  clockRatio = nominal;
+  for (long pass = 0; pass < 5; pass++) {
+    const float *signal = capture;
+    long n = length;
+    if (clockRatio != 1.0) {
+      SincResampler resampler(clockRatio);
+      resampled.resize(resampler.outputLength(length, 0));
+      resampler.process(capture, length, 0, resampled.data(),
+                        resampled.size());
+      signal = resampled.data();
+      n = (long)resampled.size();
+    }
+    computeCorrelation(signal, n);
+    if (onset < 0) return;
+    const double period = estimateMlsPeriod(
+        correlation.data(), (long)correlation.size(), P, onset);
+    onset *= clockRatio;  // back to capture samples
+    clockRatio *= period / P;
+    if (fabs(period / P - 1) < 1e-7) break;
+  }
+}
 
+double MLSGen::estimateClockRatio(const float *capture, long length) {
+  estimateDiff(capture, length);
+  return clockRatio;
 }
 
+long MLSGen::averageDriftCorrected(const float *capture, long length,
+                                   long numPeriods, double rejectThreshold) {
+  estimateDiff(capture, length);
+  if (onset < 0) return 0;
+  SincResampler resampler(clockRatio);
+  resampled.resize(resampler.outputLength(length, onset));
+  resampler.process(capture, length, onset, resampled.data(),
+                    resampled.size());
+  return averageCapture(resampled.data(), (long)resampled.size(), 0,
+                        numPeriods, rejectThreshold);
+}
 
 #endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPOMSE_MLSGEN_MLSGEN_HPP_
\ No newline at end of file
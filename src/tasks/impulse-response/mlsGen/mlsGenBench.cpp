@@ -0,0 +1,221 @@
+// Benchmark of the MLS engine stages, built by `make mlsGen_bench`.
+//
+//   mlsGenBench [--json] [--threads T] [--min-order N] [--max-order N]
+//
+// For every order it reports the time per call, ns per sample, the bytes each
+// stage has to move through memory at least (its input, output and tables,
+// once each) with the resulting bandwidth, and the peak RSS of the process.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "deconvolution.hpp"
+#include "hadamard.hpp"
+#include "lfsr.hpp"
+#include "mlsGenCApi.h"
+#include "mlsGenT.hpp"
+#include "tags.hpp"
+
+struct BenchResult {
+  const char *stage;
+  long N;
+  double seconds;  // per call, best of the repetitions
+  double bytes;    // minimum memory traffic per call
+};
+
+/**
+ * @brief Time fn, repeating it until one measurement takes at least 20 ms,
+ * and return the best time per call over five measurements.
+ */
+template <typename Fn>
+double TimeCall(const Fn &fn) {
+  typedef std::chrono::steady_clock Clock;
+  long calls = 1;
+  double best = 1e30;
+  fn();  // warm up caches and first-touch pages
+  for (;;) {
+    const Clock::time_point start = Clock::now();
+    for (long i = 0; i < calls; i++) fn();
+    const double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    if (elapsed >= 0.02) break;
+    calls *= 2;
+  }
+  for (long rep = 0; rep < 5; rep++) {
+    const Clock::time_point start = Clock::now();
+    for (long i = 0; i < calls; i++) fn();
+    const double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    best = std::min(best, elapsed / calls);
+  }
+  return best;
+}
+
+/**
+ * @brief Peak resident set size of the process in bytes.
+ */
+long PeakRss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss * 1024L;  // kilobytes on Linux
+}
+
+/**
+ * @brief Time every stage for order N and append the results.
+ */
+void BenchOrder(long N, long threads, std::vector<BenchResult> &results) {
+  const long n = 1L << N;
+  const long P = n - 1;
+  const double fs = sizeof(float), ts = sizeof(uint32_t);
+  std::vector<uint64_t> mls(packedWords(P));
+  std::vector<uint32_t> tagSInv(n), tagLInv(n);
+  long unitTags[kMaxMlsOrder];
+  std::vector<float> signal(P), work(n), resp(n);
+  std::vector<float> scratch(fhtScratchSize<float>(N) + 1);
+  long i;
+
+  generatePackedMls(N, mls.data());
+  generateTagSInverse(mls.data(), tagSInv.data(), N);
+  generateTagLInverse(tagLInv.data(), N);
+  findUnitTags(mls.data(), N, unitTags);
+  for (i = 0; i < P; i++) signal[i] = (i * 7919) % 1000 / 1000.0f - 0.5f;
+
+  results.push_back({"generateMls", N,
+                     TimeCall([&] { generatePackedMls(N, mls.data()); }),
+                     mls.size() * 8.0});
+  results.push_back(
+      {"generateTagS", N, TimeCall([&] {
+         generateTagSInverse(mls.data(), tagSInv.data(), N);
+       }),
+       mls.size() * 8.0 + n * ts});
+  results.push_back({"generateTagL", N,
+                     TimeCall([&] { generateTagLInverse(tagLInv.data(), N); }),
+                     n * ts});
+  results.push_back({"permuteSignal", N, TimeCall([&] {
+                       permuteSignalByTagS(signal.data(), tagSInv.data(), P,
+                                           work.data());
+                     }),
+                     P * fs + n * ts + n * fs});
+  results.push_back({"fastHadamard", N, TimeCall([&] {
+                       fastHadamardTransform(work.data(), N, scratch.data());
+                     }),
+                     (fhtScratchSize<float>(N) ? 4.0 : 2.0) * n * fs});
+  results.push_back({"permuteResponse", N, TimeCall([&] {
+                       permuteResponseByTagL(work.data(), tagLInv.data(), P,
+                                             resp.data());
+                     }),
+                     n * fs + n * ts + n * fs});
+  results.push_back({"permuteOnTheFly", N, TimeCall([&] {
+                       permuteSignalByMls(signal.data(), mls.data(), unitTags,
+                                          N, work.data());
+                       permuteResponseByMls(work.data(), mls.data(), unitTags,
+                                            N, resp.data());
+                     }),
+                     P * fs + 2 * n * fs + n * fs + mls.size() * 16.0});
+
+  // the table-free deconvolution, for any order and specialized for this one
+  const OnTheFlyKernel<float> fixed = onTheFlyKernel<float>(N);
+  results.push_back({"onTheFlyGeneric", N, TimeCall([&] {
+                       deconvolveMlsOnTheFly(signal.data(), mls.data(),
+                                             unitTags, N, work.data(),
+                                             scratch.data(), resp.data());
+                     }),
+                     P * fs + 3 * n * fs + mls.size() * 16.0});
+  results.push_back({"onTheFlyFixed", N, TimeCall([&] {
+                       fixed(signal.data(), mls.data(), unitTags, N,
+                             work.data(), scratch.data(), resp.data(),
+                             nullptr);
+                     }),
+                     P * fs + 3 * n * fs + mls.size() * 16.0});
+
+  // the whole engine, through the same interface a server would use
+  mlsgen_t *gen = mlsgen_create(N, 48000, 48000, threads);
+  mlsgen_set_recording(gen, signal.data());
+  results.push_back({"getImpulseResponse", N, TimeCall([&] {
+                       mlsgen_impulse_response(gen, resp.data());
+                     }),
+                     P * fs + 2 * n * ts + 4 * n * fs + n * fs});
+  mlsgen_destroy(gen);
+
+  // Welch PSD of one period, as the spectrum plots of a calibration
+  const long bins = mlsgen_psd_bins(P, 0);
+  std::vector<float> frequencies(bins), psd(bins);
+  results.push_back({"welchPsd", N, TimeCall([&] {
+                       mlsgen_psd(signal.data(), P, 48000, 0,
+                                  frequencies.data(), psd.data());
+                     }),
+                     2 * P * fs + 3 * bins * fs});
+
+  // one settled period of the recording through a 2^13 tap inverse filter, the
+  // playback buffer of a calibration with filtering
+  const long taps = 1L << 13;
+  std::vector<float> filter(taps), convolved(P);
+  for (long i = 0; i < taps; i++) filter[i] = 1.0f / (1 + i);
+  results.push_back({"convolveLooped", N, TimeCall([&] {
+                       mlsgen_convolve_looped(signal.data(), P, filter.data(),
+                                              taps, 1, 1, convolved.data(), P);
+                     }),
+                     2 * P * fs + taps * fs});
+}
+
+int main(int argc, char **argv) {
+  bool json = false;
+  long threads = 1, minOrder = 10, maxOrder = 20;
+  for (int a = 1; a < argc; a++) {
+    if (!strcmp(argv[a], "--json")) {
+      json = true;
+    } else if (!strcmp(argv[a], "--threads") && a + 1 < argc) {
+      threads = atol(argv[++a]);
+    } else if (!strcmp(argv[a], "--min-order") && a + 1 < argc) {
+      minOrder = atol(argv[++a]);
+    } else if (!strcmp(argv[a], "--max-order") && a + 1 < argc) {
+      maxOrder = atol(argv[++a]);
+    } else {
+      fprintf(stderr,
+              "usage: %s [--json] [--threads T] [--min-order N] "
+              "[--max-order N]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  minOrder = std::max(minOrder, kMinMlsOrder);
+  maxOrder = std::min(maxOrder, kMaxMlsOrder);  // orders the engine supports
+
+  std::vector<BenchResult> results;
+  std::vector<long> peakRss;
+  for (long N = minOrder; N <= maxOrder; N++) {
+    BenchOrder(N, threads, results);
+    peakRss.push_back(PeakRss());
+  }
+
+  if (json) printf("{\"threads\": %ld, \"results\": [\n", threads);
+  for (size_t r = 0; r < results.size(); r++) {
+    const BenchResult &b = results[r];
+    const double samples = double((1L << b.N) - 1);
+    const long rss = peakRss[b.N - minOrder];
+    if (json) {
+      printf("  {\"stage\": \"%s\", \"N\": %ld, \"seconds\": %.9g, "
+             "\"nsPerSample\": %.4g, \"bytes\": %.0f, \"gbPerSecond\": %.4g, "
+             "\"peakRssBytes\": %ld}%s\n",
+             b.stage, b.N, b.seconds, b.seconds * 1e9 / samples, b.bytes,
+             b.bytes / b.seconds * 1e-9, rss,
+             r + 1 < results.size() ? "," : "");
+    } else {
+      if (r == 0 || results[r - 1].N != b.N) {
+        printf("N = %ld (P = %.0f, peak RSS %.1f MB)\n", b.N, samples,
+               rss / 1048576.0);
+      }
+      printf("  %-20s %10.1f us %8.3f ns/sample %10.0f bytes %7.2f GB/s\n",
+             b.stage, b.seconds * 1e6, b.seconds * 1e9 / samples, b.bytes,
+             b.bytes / b.seconds * 1e-9);
+    }
+  }
+  if (json) printf("]}\n");
+  return 0;
+}
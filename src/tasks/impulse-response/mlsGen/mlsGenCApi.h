@@ -0,0 +1,227 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSGENCAPI_H_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSGENCAPI_H_
+
+/*
+ * C interface to the native build of MLSGen (libmlsgen.a / libmlsgen.so, see
+ * the makefile), for running the same deconvolution engine outside the
+ * browser. Buffers are owned by the caller unless noted otherwise. No C++
+ * exception escapes: a call that runs out of memory (or that the engine
+ * rejects) returns NULL, 0, -1 or NaN as noted below.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mlsgen mlsgen_t;
+
+/* Create an engine for an MLS of order N (3 to 24). numThreads <= 1 is
+ * single threaded. Returns NULL for an unsupported order, invalid rates or
+ * when the engine cannot be allocated. */
+mlsgen_t *mlsgen_create(long N, long srcSR, long sinkSR, long numThreads);
+
+/* How the tag permutation tables are stored (mlsgen_create uses AUTO: 16 bit
+ * entries up to order 16, 32 bit up to order 20, no tables above). ON_THE_FLY
+ * keeps no tables and regenerates the tags from the sequence during every
+ * deconvolution. */
+enum {
+  MLSGEN_TAGS_AUTO = 0,
+  MLSGEN_TAGS_UINT16 = 1,
+  MLSGEN_TAGS_UINT32 = 2,
+  MLSGEN_TAGS_ON_THE_FLY = 3
+};
+
+/* mlsgen_create with a choice of tag storage (one of MLSGEN_TAGS_*). */
+mlsgen_t *mlsgen_create_with_tags(long N, long srcSR, long sinkSR,
+                                  long numThreads, int tagStorage);
+
+void mlsgen_destroy(mlsgen_t *gen);
+
+/* Bytes of the sequence and tag tables gen uses (shared between engines of
+ * the same order and tag storage). */
+long mlsgen_plan_bytes(const mlsgen_t *gen);
+
+/* Period length P = 2^N - 1. Impulse responses hold P + 1 samples. */
+long mlsgen_length(const mlsgen_t *gen);
+
+/* The MLS at +- 1, P samples owned by gen. */
+const float *mlsgen_mls(mlsgen_t *gen);
+
+/* Use double instead of float accumulation (nonzero to enable). Returns 0
+ * when its buffers cannot be allocated, 1 otherwise. */
+int mlsgen_set_double_precision(mlsgen_t *gen, int enabled);
+
+/* Average numPeriods periods of capture starting at offset into the
+ * recording to deconvolve. Returns the number of periods kept, -1 on
+ * failure. */
+long mlsgen_average(mlsgen_t *gen, const float *capture, long length,
+                    long offset, long numPeriods, double rejectThreshold);
+
+/* Use one isolated period of P samples as the recording to deconvolve. */
+void mlsgen_set_recording(mlsgen_t *gen, const float *period);
+
+/* Deconvolve the recording into resp (P + 1 samples). Returns 0 on failure,
+ * 1 otherwise. */
+int mlsgen_impulse_response(mlsgen_t *gen, float *resp);
+
+/* Deconvolve K periods, back to back, into K responses of P + 1 samples.
+ * Returns 0 on failure, 1 otherwise. */
+int mlsgen_impulse_responses(mlsgen_t *gen, const float *signals, long K,
+                             float *resps);
+
+/* Onset of the first complete MLS period in a capture, in fractional
+ * samples, from its FFT cross-correlation with the MLS. -1 when the capture
+ * is shorter than one period or on failure. */
+double mlsgen_estimate_onset(mlsgen_t *gen, const float *capture,
+                             long length);
+
+/* Capture samples per MLS sample (nominally sinkSR / srcSR), from the
+ * spacing of the correlation peaks of consecutive periods. NaN on failure. */
+double mlsgen_estimate_clock_ratio(mlsgen_t *gen, const float *capture,
+                                   long length);
+
+/* Resample the capture onto the MLS clock from the onset of its first
+ * period, then average numPeriods periods into the recording to
+ * deconvolve. Returns the number of periods kept, -1 on failure. */
+long mlsgen_average_drift_corrected(mlsgen_t *gen, const float *capture,
+                                    long length, long numPeriods,
+                                    double rejectThreshold);
+
+/* Start a streamed recording, dropping offset samples before the first
+ * period (-1 to find the onset from the first two periods). Returns 0 on
+ * failure, 1 otherwise. */
+int mlsgen_stream_start(mlsgen_t *gen, long offset);
+
+/* Add n samples of the stream. Returns the periods this block completed, -1
+ * on failure. */
+long mlsgen_stream_push(mlsgen_t *gen, const float *block, long n);
+
+/* Number of complete periods streamed so far. */
+long mlsgen_stream_periods(const mlsgen_t *gen);
+
+/* Deconvolve the running average of the stream into resp (P + 1 samples).
+ * Returns the energy of the change since the previous call relative to the
+ * response, -1 on the first call, NaN on failure. */
+double mlsgen_stream_impulse_response(mlsgen_t *gen, float *resp);
+
+/* Number of frequencies mlsgen_frequency_response gives for n samples: the
+ * bins of a real FFT of n rounded up to a power of two. */
+long mlsgen_frequency_response_bins(long n);
+
+/* Gain in dB of an impulse response of n samples at sampleRate, at the
+ * frequencies (in Hz) of the bins of its zero-padded FFT. frequencies and
+ * gains hold mlsgen_frequency_response_bins(n) values. Returns that count, 0
+ * on failure. */
+long mlsgen_frequency_response(const float *ir, long n, double sampleRate,
+                               float *frequencies, float *gains);
+
+/* Gain of a curve (count increasing frequencies in Hz, gains in dB) at one
+ * frequency, interpolated linearly and held at the end values outside. */
+double mlsgen_gain_at_frequency(const float *frequencies, const float *gains,
+                                long count, double frequency);
+
+/* Phase of mlsgen_impulse_response_from_gains. */
+enum { MLSGEN_PHASE_LINEAR = 0, MLSGEN_PHASE_MINIMUM = 1 };
+
+/* Impulse response of length samples at sampleRate whose gain follows a curve
+ * (count increasing frequencies in Hz, gains in dB), linear phase (symmetric
+ * about (length - 1) / 2) or minimum phase (one of MLSGEN_PHASE_*). Returns 0
+ * on failure, 1 otherwise. */
+int mlsgen_impulse_response_from_gains(const float *frequencies,
+                                       const float *gains, long count,
+                                       double sampleRate, long length,
+                                       int phase, float *ir);
+
+/* Number of frequencies mlsgen_psd gives for n samples and segments of at
+ * most maxSegment samples (<= 0 for the default of 2^15). */
+long mlsgen_psd_bins(long n, long maxSegment);
+
+/* One-sided power spectral density of n samples at sampleRate by Welch's
+ * method (periodic Hann segments of a power of two up to maxSegment samples,
+ * half overlapping, mean removed; scipy.signal.welch with those settings),
+ * in units^2 / Hz. frequencies and psd hold mlsgen_psd_bins(n, maxSegment)
+ * values. Returns the number of segments averaged, 0 when n < 1 or on
+ * failure. */
+long mlsgen_psd(const float *x, long n, double sampleRate, long maxSegment,
+                float *frequencies, float *psd);
+
+/* Subtract a known gain curve (count increasing frequencies in Hz, gains in
+ * dB, interpolated as mlsgen_gain_at_frequency) from bins values of psd at
+ * frequencies, in place. */
+void mlsgen_subtract_gains(const float *frequencies, float *psd, long bins,
+                           const float *knownFrequencies,
+                           const float *knownGains, long count);
+
+/* Settings of mlsgen_inverse_filter. */
+typedef struct {
+  double lowHz;                /* band of the inverse filter, Hz */
+  double highHz;
+  double regularizationDb;     /* dynamic range of the inverse, e.g. 40 dB */
+  double maxBoostDb;           /* peak gain of the inverse in the band, dB */
+  double smoothOctaves;        /* smoothing of the measured gains, 0 for none */
+  double smoothMinBandwidthHz; /* narrowest smoothing window, Hz */
+  long length;                 /* samples of inverse impulse response */
+  int phase;                   /* one of MLSGEN_PHASE_* */
+} mlsgen_inverse_filter_options;
+
+/* Design the inverse filter of count measured impulse responses of n samples
+ * at sampleRate, one after the other, less a known gain curve (knownCount
+ * increasing frequencies in Hz, gains in dB; 0 for none). frequencies and
+ * gains get mlsgen_frequency_response_bins(n) values of the measured response
+ * (power averaged, known curve subtracted, smoothed), and unless null angles
+ * its phase in rad and componentAngles that phase less the minimum phase of
+ * the known curve (the component's, the known curve being a calibrated
+ * microphone); iir and iirNoBandpass get options->length samples of the
+ * inverse within the band and over every frequency, and fMaxHz (unless null)
+ * the frequency of its peak. Returns the gain in dB that brings that peak to
+ * options->maxBoostDb, which iir and iirNoBandpass leave out; NaN on
+ * failure. */
+double mlsgen_inverse_filter(const float *irs, long count, long n,
+                             double sampleRate, const float *knownFrequencies,
+                             const float *knownGains, long knownCount,
+                             const mlsgen_inverse_filter_options *options,
+                             float *frequencies, float *gains, float *angles,
+                             float *componentAngles, float *iir,
+                             float *iirNoBandpass, double *fMaxHz);
+
+typedef struct mlsgen_convolver mlsgen_convolver_t;
+
+/* Create a streaming convolution with length samples of filter h (copied),
+ * by partitioned overlap-save on blocks of block samples (a power of two,
+ * <= 0 for the default of 1024). nonUniform grows the partitions along the
+ * filter, which is cheaper for long filters. Returns NULL for an empty filter,
+ * a block that is not a power of two or when it cannot be allocated. */
+mlsgen_convolver_t *mlsgen_convolver_create(const float *h, long length,
+                                            long block, int nonUniform);
+
+/* Samples per call of mlsgen_convolver_process. */
+long mlsgen_convolver_block(const mlsgen_convolver_t *convolver);
+
+/* Filter the next block samples of in into block samples of out, with no
+ * delay: out[i] = sum of h[m] * x[now + i - m] over the whole input so far. */
+void mlsgen_convolver_process(mlsgen_convolver_t *convolver, const float *in,
+                              float *out);
+
+/* Start again from silence. */
+void mlsgen_convolver_reset(mlsgen_convolver_t *convolver);
+
+void mlsgen_convolver_destroy(mlsgen_convolver_t *convolver);
+
+/* n samples of period samples of x played in a loop through length samples
+ * of filter h, times gain. steadyState skips the first length - 1 samples, so
+ * the first period of y is the circular convolution of x and h (an MLS
+ * playing through the inverse filter after it has settled). Returns 0 for an
+ * empty x or h or on failure, 1 otherwise. */
+int mlsgen_convolve_looped(const float *x, long period, const float *h,
+                           long length, float gain, int steadyState, float *y,
+                           long n);
+
+/* Drop the cached MLS, FFT and Welch plans no engine is using and free the
+ * pooled working buffers. Returns how many plans and buffers were released. */
+long mlsgen_release_cached_plans(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSGENCAPI_H_
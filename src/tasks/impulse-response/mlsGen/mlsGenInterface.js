@@ -16,6 +16,393 @@ class MlsGenInterface {
   /** @private */
   #MLSGenInstance; // the MLSGen object instance
 
+  /** @private */
+  #recordingView = null; // capture slot of the input arena
+
+  /** @private */
+  #streamBlockView = null; // stream block slot of the input arena
+
+  /**
+   * The WASM module is loaded once and shared, so the MLS plans it caches (sequence and
+   * permutation tables per order) survive from one MLSGen instance to the next.
+   *
+   * @private
+   */
+  static #modulePromise = null;
+
+  /**
+   * How the MLS permutation tables are stored (see the tagStorage argument of factory): by default
+   * the smallest table that fits up to order 20 and none above, 16 or 32 bit tables, or no tables
+   * at all, which keeps WASM memory low at high orders for a slower deconvolution.
+   */
+  static TagStorage = Object.freeze({auto: 0, uint16: 1, uint32: 2, onTheFly: 3});
+
+  /**
+   * The shared WASM module, loaded on first use.
+   *
+   * @private
+   * @returns the module
+   * @example
+   */
+  static #getModule = () => {
+    if (MlsGenInterface.#modulePromise === null) {
+      MlsGenInterface.#modulePromise = createMLSGenModule();
+    }
+    return MlsGenInterface.#modulePromise;
+  };
+
+  /**
+   * Release the plans and pooled buffers the shared module keeps for reuse, once a calibration is
+   * over. Does nothing if the module was never loaded.
+   *
+   * @returns number of plans and buffers released.
+   * @example
+   */
+  static releaseModuleCaches = async () => {
+    if (MlsGenInterface.#modulePromise === null) return 0;
+    const module = await MlsGenInterface.#modulePromise;
+    return module['releaseCachedPlans']();
+  };
+
+  /**
+   * Frequency response of an impulse response, computed in the WASM module instead of by the
+   * 'frequency-response' task of the Python server, in the same shape as the server's answer. The
+   * gains are in dB at the bins of the zero-padded FFT of the impulse response, and the impulse
+   * response itself is returned unchanged (the same for the 1000 Hz tone).
+   *
+   * @param root0
+   * @param root0.impulseResponse - samples at sampleRate
+   * @param root0.sampleRate - in Hz
+   * @param root0.timeArray - sample times in seconds, optional
+   * @returns {frequencies, gains, gain_at_1000hz, impulse_response, impulse_response_1000hz}, or
+   * null when timeArray is not evenly spaced at 1 / sampleRate and the server must resample it.
+   * @example
+   */
+  static getFrequencyResponseFromImpulseResponse = async ({
+    impulseResponse,
+    sampleRate,
+    timeArray = null,
+  }) => {
+    if (!MlsGenInterface.#isSampledAt(timeArray, impulseResponse.length, sampleRate)) {
+      return null;
+    }
+    const module = await MlsGenInterface.#getModule();
+    const response = module['getFrequencyResponse'](impulseResponse, sampleRate);
+    const ir = Array.from(impulseResponse);
+    return {
+      frequencies: Array.from(response.frequencies),
+      gains: Array.from(response.gains),
+      gain_at_1000hz: response.gainAt1000Hz,
+      impulse_response: ir,
+      impulse_response_1000hz: ir,
+    };
+  };
+
+  /**
+   * Impulse response with a given gain curve, computed in the WASM module instead of by the
+   * 'frequency-response-to-impulse-response' task of the Python server, in the same shape as the
+   * server's answer. The gains are interpolated linearly in frequency between the points of the
+   * curve and held at its ends.
+   *
+   * @param root0
+   * @param root0.frequencies - increasing frequencies in Hz
+   * @param root0.gains - gains in dB at the frequencies
+   * @param root0.sample_rate - in Hz
+   * @param root0.iir_length - samples of impulse response
+   * @param root0.calibrateSoundIIRPhase - 'linear' or 'minimum'
+   * @returns {frequencies, gains, gain_at_1000hz, impulse_response, impulse_response_1000hz}, or
+   * null for a phase the module does not design, for the server to handle.
+   * @example
+   */
+  static getImpulseResponseFromFrequencyResponse = async ({
+    frequencies,
+    gains,
+    sample_rate: sampleRate,
+    iir_length: length,
+    calibrateSoundIIRPhase = 'linear',
+  }) => {
+    if (calibrateSoundIIRPhase !== 'linear' && calibrateSoundIIRPhase !== 'minimum') {
+      return null;
+    }
+    const module = await MlsGenInterface.#getModule();
+    const phase =
+      calibrateSoundIIRPhase === 'minimum' ? module['minimumPhase'] : module['linearPhase'];
+    const ir = Array.from(
+      module['getImpulseResponseFromGains'](frequencies, gains, sampleRate, length, phase)
+    );
+    return {
+      frequencies: Array.from(frequencies),
+      gains: Array.from(gains),
+      gain_at_1000hz: module['getGainAtFrequency'](frequencies, gains, 1000),
+      impulse_response: ir,
+      impulse_response_1000hz: ir,
+    };
+  };
+
+  /**
+   * One-sided power spectral density of a recording by Welch's method, computed in the WASM
+   * module instead of by the PSD tasks of the Python server: periodic Hann segments of a power of
+   * two up to maxSegment samples, overlapping by half, each with its mean removed.
+   *
+   * @param root0
+   * @param root0.signal - samples at sampleRate
+   * @param root0.sampleRate - in Hz
+   * @param root0.maxSegment - longest segment in samples, 0 for the module's default (2^15)
+   * @param root0.knownFrequencies - frequencies in Hz of a known gain curve to subtract, optional
+   * @param root0.knownGains - gains in dB of the known curve (e.g. the microphone's), optional
+   * @returns {x, y}: frequencies in Hz and densities in units^2 / Hz, or null for an empty signal.
+   * @example
+   */
+  static getPowerSpectralDensity = async ({
+    signal,
+    sampleRate,
+    maxSegment = 0,
+    knownFrequencies = [],
+    knownGains = [],
+  }) => {
+    if (signal === null || signal === undefined || signal.length === 0) return null;
+    const module = await MlsGenInterface.#getModule();
+    const density = module['getPowerSpectralDensity'](
+      signal,
+      sampleRate,
+      maxSegment,
+      knownFrequencies,
+      knownGains
+    );
+    return {x: Array.from(density.frequencies), y: Array.from(density.psd)};
+  };
+
+  /**
+   * Inverse filter of measured impulse responses, designed in the WASM module instead of by the
+   * inverse impulse response tasks of the Python server: the power-averaged response, less a known
+   * gain curve and smoothed, is inverted with regularization, limited to lowHz-highHz and
+   * reconstructed with linear or minimum phase.
+   *
+   * @param root0
+   * @param root0.impulseResponses - measured IRs of equal length at sampleRate
+   * @param root0.sampleRate - in Hz
+   * @param root0.lowHz - band of the inverse filter
+   * @param root0.highHz
+   * @param root0.iirLength - samples of inverse impulse response
+   * @param root0.calibrateSoundIIRPhase - 'linear' or 'minimum'
+   * @param root0.maxBoostDb - peak gain of the inverse in the band, dB
+   * @param root0.knownFrequencies - frequencies in Hz of a known gain curve to take out, optional
+   * @param root0.knownGains - its gains in dB, optional
+   * @param root0.smoothOctaves - smoothing of the measured gains, optional
+   * @param root0.smoothMinBandwidthHz - narrowest smoothing window, optional
+   * @param root0.regularizationDb - dynamic range of the inverse, optional
+   * @param root0.audioContext - if given, the inverse is also returned as a playable AudioBuffer
+   * @returns {frequencies, gainsOrigin, gains, angles, componentAngles, iir, iirNoBandpass,
+   * attenuatorGainDb, fMaxHz, audioBuffer}, with Float32Array responses (componentAngles: angles
+   * less the minimum phase of the known curve); iir and iirNoBandpass leave out attenuatorGainDb,
+   * like the server's, for getConvolution to apply. null for a phase other than 'linear' or
+   * 'minimum'.
+   * @example
+   */
+  static getInverseFilter = async ({
+    impulseResponses,
+    sampleRate,
+    lowHz,
+    highHz,
+    iirLength,
+    calibrateSoundIIRPhase,
+    maxBoostDb = 0,
+    knownFrequencies = [],
+    knownGains = [],
+    smoothOctaves = 0,
+    smoothMinBandwidthHz = 0,
+    regularizationDb = null,
+    audioContext = null,
+  }) => {
+    if (calibrateSoundIIRPhase !== 'linear' && calibrateSoundIIRPhase !== 'minimum') return null;
+    if (!impulseResponses || impulseResponses.length === 0) return null;
+    const module = await MlsGenInterface.#getModule();
+    const filter = module['getInverseFilter'](
+      impulseResponses,
+      sampleRate,
+      knownFrequencies,
+      knownGains,
+      {
+        lowHz,
+        highHz,
+        regularizationDb: regularizationDb ?? module['defaultRegularizationDb'],
+        maxBoostDb,
+        smoothOctaves,
+        smoothMinBandwidthHz,
+        length: iirLength,
+        phase:
+          calibrateSoundIIRPhase === 'minimum' ? module['minimumPhase'] : module['linearPhase'],
+      }
+    );
+    let audioBuffer = null;
+    if (audioContext) {
+      audioBuffer = audioContext.createBuffer(1, filter.iir.length, sampleRate);
+      audioBuffer.copyToChannel(filter.iir, 0);
+    }
+    return {...filter, audioBuffer};
+  };
+
+  /**
+   * Level and distortion of a recording of the 1000 Hz calibration tone, computed in the WASM
+   * module instead of by the volume task of the Python server.
+   *
+   * @param root0
+   * @param root0.signal - samples of the settled tone at sampleRate
+   * @param root0.sampleRate - in Hz
+   * @param root0.lCalib - dB SPL of a recording with an RMS of 1
+   * @returns {outDbSPL, outDbSPL1000, thd}: levels in dB SPL of the recording and of its 1000 Hz
+   * component, and the total harmonic distortion in percent; null for an empty or silent signal.
+   * @example
+   */
+  static getVolume = async ({signal, sampleRate, lCalib}) => {
+    if (signal === null || signal === undefined || signal.length === 0) return null;
+    const module = await MlsGenInterface.#getModule();
+    const levels = module['getVolume'](signal, sampleRate, lCalib);
+    // the server rejects Infinity from a silent recording, leave that to it
+    if (![levels.outDbSPL, levels.outDbSPL1000, levels.thd].every(Number.isFinite)) return null;
+    return {outDbSPL: levels.outDbSPL, outDbSPL1000: levels.outDbSPL1000, thd: levels.thd};
+  };
+
+  /**
+   * Fit of the speaker's sound level model (soft-knee compressor T, W, R, gain and background) to
+   * the levels of a 1000 Hz sweep, computed in the WASM module instead of by the volume-parameters
+   * task of the Python server. It starts from warmStart only when the caller passes one (e.g. the
+   * stored parameters of the same speaker and microphone), and from cold starts otherwise.
+   *
+   * @param root0
+   * @param root0.inDBValues - digital levels of the tones in dB
+   * @param root0.outDBSPLValues - their measured levels in dB SPL
+   * @param root0.warmStart - {T, W, R, gainDBSPL, backgroundDBSPL} to start from, optional
+   * @returns {T, W, R, gainDBSPL, backgroundDBSPL, RMSError}, or null without levels.
+   * @example
+   */
+  static getVolumeParameters = async ({
+    inDBValues,
+    outDBSPLValues,
+    warmStart = null,
+  }) => {
+    if (!inDBValues || !outDBSPLValues || inDBValues.length === 0) return null;
+    if (inDBValues.length !== outDBSPLValues.length) return null;
+    const module = await MlsGenInterface.#getModule();
+    const fit = module['getVolumeParameters'](inDBValues, outDBSPLValues, warmStart);
+    return {
+      T: fit.T,
+      W: fit.W,
+      R: fit.R,
+      gainDBSPL: fit.gainDBSPL,
+      backgroundDBSPL: fit.backgroundDBSPL,
+      RMSError: fit.RMSError,
+    };
+  };
+
+  /**
+   * The MLS played in a loop through the inverse filters, computed in the WASM module by
+   * partitioned FFT convolution instead of by the convolution task of the Python server: one
+   * settled period (the circular convolution) through each filter, times amplitude.
+   *
+   * @param root0
+   * @param root0.mls - one period of the MLS
+   * @param root0.inverseResponse - inverse impulse response within the band
+   * @param root0.inverseResponseNoBandpass - inverse over every frequency, optional
+   * @param root0.amplitude - gain of the MLS
+   * @param root0.attenuatorGainDb - gain in dB of the inverse filter, which its responses leave out
+   * (the attenuatorGainDb of getInverseFilter, or the server's attenuatorGain_dB), optional
+   * @returns {convolution, convolution_no_bandpass} arrays of mls.length samples (the second only
+   * with inverseResponseNoBandpass), or null without an MLS or inverse.
+   * @example
+   */
+  static getConvolution = async ({
+    mls,
+    inverseResponse,
+    inverseResponseNoBandpass = null,
+    amplitude = 1,
+    attenuatorGainDb = 0,
+  }) => {
+    if (!mls || mls.length === 0 || !inverseResponse || inverseResponse.length === 0) return null;
+    // an attenuation that is not a number is left to the server
+    const attenuationDb = attenuatorGainDb ?? 0;
+    if (!Number.isFinite(attenuationDb)) return null;
+    const gain = amplitude * Math.pow(10, attenuationDb / 20);
+    const module = await MlsGenInterface.#getModule();
+    const result = {
+      convolution: Array.from(
+        module['getLoopedConvolution'](mls, inverseResponse, gain, true, mls.length)
+      ),
+    };
+    if (inverseResponseNoBandpass && inverseResponseNoBandpass.length > 0) {
+      result.convolution_no_bandpass = Array.from(
+        module['getLoopedConvolution'](mls, inverseResponseNoBandpass, gain, true, mls.length)
+      );
+    }
+    return result;
+  };
+
+  /**
+   * A signal played in a loop through a chain of impulse responses (e.g. loudspeaker then
+   * microphone), from silence, computed in the WASM module instead of by the ir-convolution task
+   * of the Python server.
+   *
+   * @param root0
+   * @param root0.signal - one period of the looped signal
+   * @param root0.impulseResponses - filters applied one after the other
+   * @param root0.length - samples of output
+   * @returns Float32Array of length samples, or null without a signal, filter or length.
+   * @example
+   */
+  static getChainConvolution = async ({signal, impulseResponses, length}) => {
+    if (!signal || signal.length === 0 || !(length > 0)) return null;
+    if (!impulseResponses || impulseResponses.some(ir => !ir || ir.length === 0)) return null;
+    const module = await MlsGenInterface.#getModule();
+    // the loop through the first filter, then that output through the rest (no longer periodic)
+    let output = module['getLoopedConvolution'](signal, impulseResponses[0], 1, false, length);
+    for (const ir of impulseResponses.slice(1)) {
+      output = module['getLoopedConvolution'](output, ir, 1, false, length);
+    }
+    return output;
+  };
+
+  /**
+   * Stream a signal played in a loop through a filter, one block at a time, so playback can start
+   * on the first blocks while the rest are computed. The generator runs until the caller stops
+   * iterating (break or return), which frees the stream in the WASM module.
+   *
+   * @param root0
+   * @param root0.signal - one period of the looped signal
+   * @param root0.ir - the filter
+   * @param root0.gain - applied to every sample
+   * @param root0.steadyState - start settled, as getConvolution, instead of from silence
+   * @yields Float32Array blocks of the output, in order
+   * @example
+   * for await (const block of MlsGenInterface.convolutionBlocks({signal: mls, ir})) {
+   *   if (!enqueue(block)) break;
+   * }
+   */
+  static async *convolutionBlocks({signal, ir, gain = 1, steadyState = false}) {
+    const module = await MlsGenInterface.#getModule();
+    const stream = new module['ConvolutionStream'](signal, ir, gain, steadyState);
+    try {
+      for (;;) yield stream['nextBlock']();
+    } finally {
+      stream.delete();
+    }
+  }
+
+  /**
+   * Whether sample times are those of length samples at sampleRate (any start time), or absent.
+   *
+   * @private
+   * @example
+   */
+  static #isSampledAt = (timeArray, length, sampleRate) => {
+    if (timeArray === null || timeArray === undefined) return true;
+    if (timeArray.length !== length) return false;
+    const step = 1 / sampleRate;
+    for (let i = 1; i < length; i += 1) {
+      if (Math.abs(timeArray[i] - timeArray[i - 1] - step) > 1e-3 * step) return false;
+    }
+    return true;
+  };
+
   /**
    * Creates an instance of MlsGenInterface.
    * Makes a call to the WASM glue code to load the WASM module.
@@ -24,9 +411,18 @@ class MlsGenInterface {
    * @param mlsOrder
    * @param sourceSamplingRate
    * @param sinkSamplingRate
+   * @param numThreads - threads for the deconvolution (needs the pthreads build)
+   * @param tagStorage - one of MlsGenInterface.TagStorage
    * @example
    */
-  constructor(WASMInstance, mlsOrder, sourceSamplingRate, sinkSamplingRate) {
+  constructor(
+    WASMInstance,
+    mlsOrder,
+    sourceSamplingRate,
+    sinkSamplingRate,
+    numThreads = 1,
+    tagStorage = MlsGenInterface.TagStorage.auto
+  ) {
     this.#mlsOrder = mlsOrder;
     this.#WASMInstance = WASMInstance;
 
@@ -34,7 +430,9 @@ class MlsGenInterface {
     this.#MLSGenInstance = new this.#WASMInstance['MLSGen'](
       mlsOrder,
       sourceSamplingRate,
-      sinkSamplingRate
+      sinkSamplingRate,
+      numThreads,
+      tagStorage
     );
   }
 
@@ -42,21 +440,45 @@ class MlsGenInterface {
    * Factory function that provide an asynchronous function that fetches the WASM module
    * and returns a promise that resolves when the module is loaded.
    *
-   * @param mlsOrder
+   * @param mlsOrder - order N of the MLS (period 2^N - 1), 3 to 24. Above order 20 the
+   * permutation tables are regenerated on the fly by default (see TagStorage).
    * @param sourceSamplingRate - The sampling rate of the source audio.
    * @param sinkSamplingRate - The sampling rate of the sink audio.
+   * @param numThreads - Threads for the deconvolution. Only a WASM build with pthreads
+   * (make mlsGen_bind PTHREADS=1) uses more than one; others fall back to a single thread.
+   * @param tagStorage - one of MlsGenInterface.TagStorage, e.g. onTheFly for high orders on
+   * low-memory devices.
    * @returns MlsGenInterface.
    * @example
    */
-  static factory = async (mlsOrder, sourceSamplingRate, sinkSamplingRate) => {
+  static factory = async (
+    mlsOrder,
+    sourceSamplingRate,
+    sinkSamplingRate,
+    numThreads = 1,
+    tagStorage = MlsGenInterface.TagStorage.auto
+  ) => {
     if (sourceSamplingRate === undefined || sinkSamplingRate === undefined) {
       throw new Error('sourceSamplingRate and sinkSamplingRate must be defined');
     }
+    const module = await MlsGenInterface.#getModule();
+    const order = Number(mlsOrder);
+    if (
+      !Number.isInteger(order) ||
+      order < module['minMlsOrder'] ||
+      order > module['maxMlsOrder']
+    ) {
+      throw new Error(
+        `mlsOrder must be an integer from ${module['minMlsOrder']} to ${module['maxMlsOrder']}`
+      );
+    }
     return new MlsGenInterface(
-      await createMLSGenModule().then(instance => instance),
+      module,
       mlsOrder,
       sourceSamplingRate,
-      sinkSamplingRate
+      sinkSamplingRate,
+      numThreads,
+      tagStorage
     );
   };
 
@@ -89,11 +511,22 @@ class MlsGenInterface {
         this.#MLSGenInstance['Destruct'](); // Call the destructor
         this.#MLSGenInstance['delete'](); // Delete the object
         console.warn(`GARBAGE COLLECTION: deleted MLSGen`);
-        this.#WASMInstance['doLeakCheck'](); // Check for memory leaks
+        if (this.#WASMInstance['doLeakCheck'] !== undefined) {
+          this.#WASMInstance['doLeakCheck'](); // Check for memory leaks (sanitized builds only)
+        }
       }
     }
   };
 
+  /**
+   * Release the cached MLS plans that no MLSGen instance is using, and the pooled working buffers
+   * that destroyed instances left for reuse, e.g. once a calibration session is over.
+   *
+   * @returns number of plans and buffers released.
+   * @example
+   */
+  releaseCachedPlans = () => this.#WASMInstance['releaseCachedPlans']();
+
   /**
    * Calculate and return the Impulse Response of the recorded signal.
    *
@@ -103,20 +536,157 @@ class MlsGenInterface {
   getImpulseResponse = () => this.#MLSGenInstance['getImpulseResponse']();
 
   /**
-   * Given a recorded MLS signal, this function sets the recordedSignal property of the MLSGen object.
+   * Calculate the Impulse Responses of several recordings with a single call into WASM. Each
+   * recording is one MLS period (P samples); the MLS tables and working buffers are shared.
+   *
+   * @param recordings - array of Float32Array (or array), P samples each
+   * @returns array of impulse responses (P + 1 samples each), views into WASM memory.
+   * @example
+   */
+  getImpulseResponses = recordings => {
+    const P = 2 ** this.#mlsOrder - 1;
+    const batchMemoryView = this.#MLSGenInstance['setBatchMemoryView'](recordings.length);
+    recordings.forEach((recording, i) => batchMemoryView.set(recording.slice(0, P), i * P));
+    const responses = this.#MLSGenInstance['getImpulseResponses']();
+    return recordings.map((_, i) => responses.subarray(i * (P + 1), (i + 1) * (P + 1)));
+  };
+
+  /**
+   * View of the capture slot of the MLSGen input arena, length samples long. Filling it directly
+   * (e.g. from an AudioWorklet, or with Float32Array.set) and passing it to setRecordedSignals or
+   * setRecordedSignalsDriftCorrected avoids copying the capture. The slot is reused from one
+   * capture to the next and only reallocated when a capture outgrows it.
+   *
+   * @param length - number of samples in the capture
+   * @returns Float32Array view into WASM memory.
+   * @example
+   */
+  getRecordingBuffer = length => {
+    this.#recordingView = this.#MLSGenInstance['setRecordedSignalsMemoryView'](length);
+    return this.#recordingView;
+  };
+
+  /**
+   * Hand a capture to the capture slot, unless it already is the view from getRecordingBuffer.
    *
-   * @param signals
+   * @private
+   * @param capture
    * @example
    */
-  setRecordedSignals = signals => {
-    // get memory view
-    const averagedSignals = this.average(signals);
-    const recordedSignalsMemoryView = this.#MLSGenInstance['setRecordedSignalsMemoryView'](
-      averagedSignals.byteLength
+  #loadCapture = capture => {
+    // the samples are already in the slot; they stay there even if the WASM memory has grown since
+    // (which detaches the view), so only the slot is selected again
+    if (this.#recordingView !== null && capture === this.#recordingView) {
+      this.#MLSGenInstance['setRecordedSignalsMemoryView'](capture.length);
+      return;
+    }
+    this.getRecordingBuffer(capture.length).set(capture);
+  };
+
+  /**
+   * Given a raw capture holding several consecutive MLS periods, hands it to the MLSGen object,
+   * which averages the periods synchronously (optionally rejecting outlier periods) into the
+   * single period used by getImpulseResponse.
+   *
+   * @param capture - Float32Array (or array) of the recorded samples, or the view returned by
+   * getRecordingBuffer
+   * @param numPeriods - number of MLS periods in the capture
+   * @param offset - index of the first sample of the first period, or 'auto' to find it from the
+   * cross-correlation with the MLS (see getRecordedSignalsOnset)
+   * @param rejectThreshold - drop periods further than this multiple of the median distance from
+   * the mean, 0 keeps every period
+   * @returns number of periods kept in the average.
+   * @example
+   */
+  setRecordedSignals = (capture, numPeriods, offset = 0, rejectThreshold = 0) => {
+    this.#loadCapture(capture);
+    const start = offset === 'auto' ? Math.round(this.getRecordedSignalsOnset()) : offset;
+    return this.#MLSGenInstance['averageRecordedSignals'](start, numPeriods, rejectThreshold);
+  };
+
+  /**
+   * Find where the first complete MLS period starts in the capture given to setRecordedSignals,
+   * from the peak of its FFT cross-correlation with the MLS, computed in WASM.
+   *
+   * @returns onset in (fractional) samples, -1 if the capture is shorter than one period.
+   * @example
+   */
+  getRecordedSignalsOnset = () => this.#MLSGenInstance['getRecordedSignalsOnset']();
+
+  /**
+   * Like setRecordedSignals, but first corrects the clock drift between the source and sink: the
+   * sample-rate ratio is estimated from the spacing of the correlation peaks of consecutive
+   * periods, and the capture is resampled (windowed sinc) onto the MLS clock from the onset of its
+   * first period before averaging. Everything runs in WASM.
+   *
+   * @param capture - Float32Array (or array) of the recorded samples
+   * @param numPeriods - number of MLS periods to average
+   * @param rejectThreshold - see setRecordedSignals
+   * @returns number of periods kept in the average.
+   * @example
+   */
+  setRecordedSignalsDriftCorrected = (capture, numPeriods, rejectThreshold = 0) => {
+    this.#loadCapture(capture);
+    return this.#MLSGenInstance['averageRecordedSignalsDriftCorrected'](
+      numPeriods,
+      rejectThreshold
     );
-    for (let i = 0; i < averagedSignals.length; i += 1) {
-      recordedSignalsMemoryView[i] = averagedSignals[i];
+  };
+
+  /**
+   * Ratio of the sink and source clocks measured on the capture given to setRecordedSignals:
+   * capture samples per MLS sample, nominally sinkSamplingRate / sourceSamplingRate.
+   *
+   * @returns the measured ratio.
+   * @example
+   */
+  getRecordedSignalsClockRatio = () => this.#MLSGenInstance['getRecordedSignalsClockRatio']();
+
+  /**
+   * Start a streamed recording. PCM blocks (e.g. from an AudioWorklet or the channel data of
+   * decoded chunks) are then handed over with pushAudioBlock as they arrive and summed period by
+   * period in WASM, so memory stays at about one MLS period.
+   *
+   * API only for now: no calibration flow streams yet. AudioRecorder records with MediaRecorder and
+   * only has PCM once the whole compressed capture is decoded, so the blocks would all arrive at
+   * the end; streaming needs a PCM tap (an AudioWorklet) on the recording first.
+   *
+   * @param offset - samples to drop before the first period, -1 to find the onset in the stream
+   * @example
+   */
+  startStream = (offset = -1) => this.#MLSGenInstance['startStream'](offset);
+
+  /**
+   * Add a block of the streamed recording.
+   *
+   * @param block - Float32Array of PCM samples
+   * @returns number of MLS periods completed by this block; call getStreamImpulseResponse then.
+   * @example
+   */
+  pushAudioBlock = block => {
+    // the view is kept while blocks keep their size and the WASM memory does not grow
+    if (
+      this.#streamBlockView === null ||
+      this.#streamBlockView.length !== block.length ||
+      this.#streamBlockView.buffer.byteLength === 0
+    ) {
+      this.#streamBlockView = this.#MLSGenInstance['getStreamBlockMemoryView'](block.length);
     }
+    this.#streamBlockView.set(block);
+    return this.#MLSGenInstance['pushStreamBlock'](block.length);
+  };
+
+  /**
+   * Impulse response of the running average of the stream, and how much it changed since the
+   * previous call (energy of the difference relative to the response, -1 on the first call), so
+   * a calibration can stop once the estimate has converged.
+   *
+   * @returns {{impulseResponse: Float32Array, change: number}}
+   * @example
+   */
+  getStreamImpulseResponse = () => {
+    const impulseResponse = this.#MLSGenInstance['getStreamImpulseResponse']();
+    return {impulseResponse, change: this.#MLSGenInstance['getStreamChange']()};
   };
 
   /**
@@ -126,6 +696,17 @@ class MlsGenInterface {
    * @example
    */
   getMLS = () => this.#MLSGenInstance['getMLS']();
+
+  /**
+   * The MLS as it plays in a loop through a filter once settled: one period of its circular
+   * convolution with ir, times amplitude, computed from the MLS of this instance.
+   *
+   * @param ir - the filter, e.g. an inverse impulse response
+   * @param amplitude - gain of the MLS
+   * @returns Float32Array of P samples.
+   * @example
+   */
+  getConvolvedMLS = (ir, amplitude = 1) => this.#MLSGenInstance['getConvolvedMLS'](ir, amplitude);
 }
 
 export default MlsGenInterface;
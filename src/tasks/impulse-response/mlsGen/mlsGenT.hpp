@@ -0,0 +1,171 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSGENT_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSGENT_HPP_
+
+#include <stdint.h>
+
+#include <utility>
+
+#include "deconvolution.hpp"
+#include "hadamard.hpp"
+#include "lfsr.hpp"
+#include "tags.hpp"
+
+/**
+ * @brief Orders with a specialized MLSGenT: the ones calibrations use, which
+ * may be run table-free to save memory, up to the highest order, which
+ * kTagsAuto always runs table-free (above kMaxTableOrder).
+ */
+const long kMinSpecializedOrder = 14;
+const long kMaxSpecializedOrder = kMaxMlsOrder;
+
+/**
+ * @brief Compile-time description of an MLS of order kOrder: its sizes, the
+ * geometry of its transform and its feedback taps, and the table-free
+ * permutations specialized to them (the Order of deconvolveMlsOnTheFly).
+ *
+ * The running tagL is an N entry ring updated at a slot that moves by one per
+ * sample, which at run time costs a loop over the taps and a wrap-around
+ * compare per tap. Here the walk is unrolled N samples at a time, so every
+ * ring index and every tap is a constant: the taps that are not set vanish,
+ * the wrap-around is folded away and the ring stays in registers.
+ *
+ * The table-driven deconvolveMls gains nothing from a fixed order (its loops
+ * are long and bound by the table reads either way), so only the table-free
+ * path is specialized; onTheFlyKernel picks the specialization at run time.
+ */
+template <long kOrder>
+struct MLSGenT {
+  static_assert(isSupportedMlsOrder(kOrder), "MLSGenT: unsupported order");
+
+  static constexpr long N = kOrder;
+  static constexpr long n = 1L << kOrder;  // transform length
+  static constexpr long P = n - 1;         // period
+  static constexpr uint32_t tapMask = kTapMasks[kOrder];
+  template <typename T>
+  static constexpr long blockSize = fhtBlockSize<T>(n);
+  template <typename T>
+  static constexpr long scratchSize = fhtScratchSize<T>(kOrder);
+
+  /**
+   * @brief RuntimeMlsOrder::scatter for this order (the N argument only
+   * keeps the signature).
+   */
+  template <typename T>
+  static double scatter(const float *signal, const uint64_t *mls,
+                        const long *, long, long begin, long end, T *work) {
+    long i, window = 0;
+    double sum = 0;
+    for (long k = begin - N + 1; k < begin; k++) {
+      i = k < 0 ? k + P : k;
+      window = (window >> 1) | (long)((mls[i >> 6] >> (i & 63)) & 1) << (N - 1);
+    }
+    for (i = begin; i < end; i++) {
+      window = (window >> 1) | (long)((mls[i >> 6] >> (i & 63)) & 1) << (N - 1);
+      work[window] = (T)signal[i];
+      sum += signal[i];
+    }
+    return sum;
+  }
+
+  /**
+   * @brief RuntimeMlsOrder::gather for this order, N samples per unrolled
+   * step.
+   */
+  template <typename T>
+  static void gather(const T *work, const uint64_t *mls, const long *unitTags,
+                     long, long begin, long end, T fact, float *resp) {
+    long ring[N];
+    long i = begin;
+    seekTagLFromUnitTags(mls, unitTags, N, begin, ring);
+    const auto store = [&](long k, long tag) {
+      resp[k] = (float)(work[tag] * fact);
+    };
+    for (; i + N <= end; i += N) {
+      step(ring, i, store, std::make_integer_sequence<long, N>());
+    }
+    // the last few samples with the ring back at slot 0
+    for (long slot = 0; i < end; i++, slot++) {
+      store(i, ring[slot]);
+      ring[slot] ^= feedbackAt<1>(ring, slot);
+    }
+  }
+
+ private:
+  /**
+   * @brief XOR of the ring entries kLag and up past slot kSlot whose tap is
+   * set (generateTagLInverse), with the slot known at compile time.
+   */
+  template <long kSlot, long kLag = 1>
+  static long feedback(const long *ring) {
+    if constexpr (kLag >= N) {
+      return 0;
+    } else if constexpr (((tapMask >> (kLag - 1)) & 1) != 0) {
+      return ring[(kSlot + kLag) % N] ^ feedback<kSlot, kLag + 1>(ring);
+    } else {
+      return feedback<kSlot, kLag + 1>(ring);
+    }
+  }
+
+  /**
+   * @brief feedback at a slot known only at run time, for the tail.
+   */
+  template <long kLag>
+  static long feedbackAt(const long *ring, long slot) {
+    if constexpr (kLag >= N) {
+      return 0;
+    } else if constexpr (((tapMask >> (kLag - 1)) & 1) != 0) {
+      const long k = slot + kLag;
+      return ring[k < N ? k : k - N] ^ feedbackAt<kLag + 1>(ring, slot);
+    } else {
+      return feedbackAt<kLag + 1>(ring, slot);
+    }
+  }
+
+  /**
+   * @brief Samples i to i + N - 1: emit tagL at every slot and advance it.
+   */
+  template <typename Body, long... kSlots>
+  static void step(long *ring, long i, const Body &body,
+                   std::integer_sequence<long, kSlots...>) {
+    ((body(i + kSlots, ring[kSlots]), ring[kSlots] ^= feedback<kSlots>(ring)),
+     ...);
+  }
+};
+
+/**
+ * @brief Signature of deconvolveMlsOnTheFly, for its instantiations per order.
+ */
+template <typename T>
+using OnTheFlyKernel = void (*)(const float *, const uint64_t *, const long *,
+                                long, T *, T *, float *, ThreadPool *);
+
+/**
+ * @brief Runtime dispatch behind the MLSGen constructor: the table-free
+ * deconvolution of order N with the walks of MLSGenT<N> for the specialized
+ * orders, RuntimeMlsOrder for the others. Only single precision is
+ * specialized, to keep the code size of the WASM module down.
+ */
+template <typename T>
+inline OnTheFlyKernel<T> onTheFlyKernel(long N) {
+  return &deconvolveMlsOnTheFly<T, RuntimeMlsOrder>;
+}
+
+template <>
+inline OnTheFlyKernel<float> onTheFlyKernel(long N) {
+  switch (N) {
+    case 14: return &deconvolveMlsOnTheFly<float, MLSGenT<14>>;
+    case 15: return &deconvolveMlsOnTheFly<float, MLSGenT<15>>;
+    case 16: return &deconvolveMlsOnTheFly<float, MLSGenT<16>>;
+    case 17: return &deconvolveMlsOnTheFly<float, MLSGenT<17>>;
+    case 18: return &deconvolveMlsOnTheFly<float, MLSGenT<18>>;
+    case 19: return &deconvolveMlsOnTheFly<float, MLSGenT<19>>;
+    case 20: return &deconvolveMlsOnTheFly<float, MLSGenT<20>>;
+    case 21: return &deconvolveMlsOnTheFly<float, MLSGenT<21>>;
+    case 22: return &deconvolveMlsOnTheFly<float, MLSGenT<22>>;
+    case 23: return &deconvolveMlsOnTheFly<float, MLSGenT<23>>;
+    case 24: return &deconvolveMlsOnTheFly<float, MLSGenT<24>>;
+    default: return &deconvolveMlsOnTheFly<float, RuntimeMlsOrder>;
+  }
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSGENT_HPP_
@@ -1,5 +1,23 @@
+#include "limits.h"
+#include "math.h"
 #include "stdio.h"
 
+#include <vector>
+
+#include "hadamard.hpp"
+#include "inputArena.hpp"
+#include "lfsr.hpp"
+#include "mlsGenCApi.h"
+#include "mlsGenT.hpp"
+#include "resampler.hpp"
+#include "tags.hpp"
+#include "threadPool.hpp"
+#include "workArena.hpp"
+#include "../../volume/volume.hpp"
+
+// Highest order the bool tapsTab of GenerateMls below has taps for
+const long kMaxReferenceOrder = 18;
+
 void GenerateSignal(bool *mls, double *signal, long P) {
   long i;
   double *input = new double[P];
@@ -138,6 +156,857 @@ void GeneratetagS(bool *mls, long *tagS, long P, long N) {
   }
 }
 
+// Compare the word-parallel generator with GenerateMls for every order
+long CheckPackedMls() {
+  long N, P, i, errors = 0;
+  for (N = kMinMlsOrder; N <= kMaxReferenceOrder; N++) {
+    P = (1 << N) - 1;
+    bool *mls = new bool[P];
+    uint64_t *bits = new uint64_t[packedWords(P)];
+    GenerateMls(mls, P, N);
+    generatePackedMls(N, bits);
+    for (i = 0; i < P; i++) {
+      if (mls[i] != ((bits[i >> 6] >> (i & 63)) & 1)) errors++;
+    }
+    delete[] mls;
+    delete[] bits;
+  }
+  printf("Packed MLS mismatches: %ld\n", errors);
+  return errors;
+}
+
+// Check the inverse tag tables against GeneratetagL/S
+long CheckTags() {
+  long N, P, i, errors = 0;
+  for (N = kMinMlsOrder; N <= kMaxReferenceOrder; N++) {
+    P = (1 << N) - 1;
+    bool *mls = new bool[P];
+    uint64_t *bits = new uint64_t[packedWords(P)];
+    long *tagL = new long[P];
+    long *tagS = new long[P];
+    GenerateMls(mls, P, N);
+    generatePackedMls(N, bits);
+    GeneratetagL(mls, tagL, P, N);
+    GeneratetagS(mls, tagS, P, N);
+    long *inverse = new long[P + 1];
+    generateTagLInverse(inverse, N);
+    for (i = 0; i < P; i++) {
+      if (inverse[tagL[i]] != i) errors++;
+    }
+    generateTagSInverse(bits, inverse, N);
+    for (i = 0; i < P; i++) {
+      if (inverse[tagS[i]] != i) errors++;
+    }
+    delete[] inverse;
+    delete[] mls;
+    delete[] bits;
+    delete[] tagL;
+    delete[] tagS;
+  }
+  printf("Tag mismatches: %ld\n", errors);
+  return errors;
+}
+
+// Compare the blocked transform with FastHadamard for every order
+long CheckHadamard() {
+  long N, P1, i, errors = 0;
+  for (N = 1; N <= 20; N++) {
+    P1 = 1 << N;
+    double *x = new double[P1];
+    double *y = new double[P1];
+    double *scratch = new double[fhtScratchSize<double>(N)];
+    for (i = 0; i < P1; i++) x[i] = y[i] = (i * 7919) % 1000 / 1000.0 - 0.5;
+    FastHadamard(x, P1, N);
+    fastHadamardTransform(y, N, scratch);
+    for (i = 0; i < P1; i++) {
+      if (fabs(x[i] - y[i]) > 1e-9) errors++;
+    }
+    delete[] x;
+    delete[] y;
+    delete[] scratch;
+  }
+  printf("Hadamard mismatches: %ld\n", errors);
+  return errors;
+}
+
+long CheckThreads() {
+  long N, i, errors = 0;
+  ThreadPool pool(4);
+  for (N = 3; N <= 18; N++) {
+    const long n = 1L << N;
+    const long P = n - 1;
+    const long chunk = P / 5 + 1;
+    uint64_t *mls = new uint64_t[packedWords(P)];
+    long *tagSInv = new long[n];
+    long *tagLInv = new long[n];
+    long *ranged = new long[n];
+    long ring[kMaxMlsOrder];
+    generatePackedMls(N, mls);
+    generateTagSInverse(mls, tagSInv, N);
+    generateTagLInverse(tagLInv, N);
+    // tables built in ranges, as the thread pool does
+    ranged[0] = P;
+    for (i = 0; i < P; i += chunk) {
+      generateTagSInverse(mls, ranged, N, i, i + chunk < P ? i + chunk : P);
+    }
+    for (i = 0; i < n; i++) {
+      if (ranged[i] != tagSInv[i]) errors++;
+    }
+    for (i = 0; i < P; i += chunk) {
+      seekTagL(mls, tagSInv, N, i, ring);
+      generateTagLInverse(ring, ranged, N, i, i + chunk < P ? i + chunk : P);
+    }
+    for (i = 0; i < n; i++) {
+      if (ranged[i] != tagLInv[i]) errors++;
+    }
+    // the threaded transform must match the single threaded one exactly
+    float *x = new float[n];
+    float *y = new float[n];
+    float *scratch = new float[pool.size() * fhtScratchSize<float>(N) + 1];
+    for (i = 0; i < n; i++) x[i] = y[i] = (i * 7919) % 1000 / 1000.0f - 0.5f;
+    fastHadamardTransform(x, N, scratch);
+    fastHadamardTransform(y, N, scratch, &pool);
+    for (i = 0; i < n; i++) {
+      if (x[i] != y[i]) errors++;
+    }
+    delete[] mls;
+    delete[] tagSInv;
+    delete[] tagLInv;
+    delete[] ranged;
+    delete[] x;
+    delete[] y;
+    delete[] scratch;
+  }
+  printf("Threaded mismatches: %ld\n", errors);
+  return errors;
+}
+
+long CheckCApi(const double *signal, const double *resp, long N) {
+  const long P = (1 << N) - 1;
+  long i, c, errors = 0;
+  float *period = new float[P];
+  float *batch = new float[3 * P];
+  float *ir = new float[P + 1];
+  float *irs = new float[3 * (P + 1)];
+  for (i = 0; i < P; i++) {
+    period[i] = (float)signal[i];
+    for (c = 0; c < 3; c++) batch[c * P + i] = period[i];
+  }
+  for (long run = 0; run < 4; run++) {
+    const long threads = run % 2 ? 4 : 1;
+    mlsgen_t *gen = run < 2 ? mlsgen_create(N, 96000, 96000, threads)
+                            : mlsgen_create_with_tags(N, 96000, 96000, threads,
+                                                      MLSGEN_TAGS_ON_THE_FLY);
+    if (gen == nullptr || mlsgen_length(gen) != P) return errors + 1;
+    mlsgen_set_recording(gen, period);
+    if (!mlsgen_impulse_response(gen, ir)) errors++;
+    if (!mlsgen_impulse_responses(gen, batch, 3, irs)) errors++;
+    for (i = 0; i < P; i++) {
+      if (fabs(ir[i] - resp[i]) > 1e-4) errors++;
+      for (c = 0; c < 3; c++) {
+        if (irs[c * (P + 1) + i] != ir[i]) errors++;
+      }
+    }
+    mlsgen_destroy(gen);
+  }
+  if (mlsgen_create(kMaxMlsOrder + 1, 96000, 96000, 1) != nullptr) errors++;
+  // an allocation that fails (here an inverse too long for a vector) is
+  // reported, not thrown across the C interface
+  float impulse[2] = {1, 0}, hz[2], db[2], unused[1];
+  const mlsgen_inverse_filter_options tooLong = {
+      100, 16000, 40, 0, 0, 0, LONG_MAX, MLSGEN_PHASE_LINEAR};
+  if (!isnan(mlsgen_inverse_filter(impulse, 1, 2, 48000, nullptr, nullptr, 0,
+                                   &tooLong, hz, db, nullptr, nullptr, unused,
+                                   unused, nullptr))) {
+    errors++;
+  }
+  mlsgen_release_cached_plans();
+  delete[] period;
+  delete[] batch;
+  delete[] ir;
+  delete[] irs;
+  printf("C interface mismatches: %ld\n", errors);
+  return errors;
+}
+
+// Check that every tag storage gives the same responses, with and without
+// threads, and that the compact plans are smaller
+long CheckTagStorage() {
+  long N, i, errors = 0;
+  for (N = 3; N <= 17; N++) {
+    const long P = (1 << N) - 1;
+    float *period = new float[P];
+    float *ir = new float[P + 1];
+    float *other = new float[P + 1];
+    for (i = 0; i < P; i++) period[i] = (i * 7919) % 1000 / 1000.0f - 0.5f;
+    mlsgen_t *gen = mlsgen_create_with_tags(N, 48000, 48000, 1,
+                                            MLSGEN_TAGS_UINT32);
+    mlsgen_set_recording(gen, period);
+    mlsgen_impulse_response(gen, ir);
+    const long bytes32 = mlsgen_plan_bytes(gen);
+    mlsgen_destroy(gen);
+    for (int storage = MLSGEN_TAGS_AUTO; storage <= MLSGEN_TAGS_ON_THE_FLY;
+         storage++) {
+      for (long threads = 1; threads <= 3; threads += 2) {
+        gen = mlsgen_create_with_tags(N, 48000, 48000, threads, storage);
+        mlsgen_set_recording(gen, period);
+        mlsgen_impulse_response(gen, other);
+        for (i = 0; i <= P; i++) {
+          // the table-free path transforms unfused, rounding differs a little
+          if (storage == MLSGEN_TAGS_ON_THE_FLY ? fabs(other[i] - ir[i]) > 1e-6
+                                                : other[i] != ir[i]) {
+            errors++;
+          }
+        }
+        const long bytes = mlsgen_plan_bytes(gen);
+        if (storage == MLSGEN_TAGS_ON_THE_FLY && bytes * 8 > bytes32 + 512) {
+          errors++;
+        }
+        if (storage == MLSGEN_TAGS_UINT16 && N >= 8 && N <= 16 &&
+            bytes >= bytes32) {
+          errors++;
+        }
+        mlsgen_destroy(gen);
+      }
+    }
+    delete[] period;
+    delete[] ir;
+    delete[] other;
+  }
+  mlsgen_release_cached_plans();
+  printf("Tag storage mismatches: %ld\n", errors);
+  return errors;
+}
+
+// Check that every feedback polynomial is primitive (the register only comes
+// back to its start after 2^N - 1 steps) and deconvolve above order 18
+long CheckHighOrders() {
+  long N, i, k, errors = 0;
+  for (N = kMinMlsOrder; N <= kMaxMlsOrder; N++) {
+    const long P = (1L << N) - 1;
+    Lfsr lfsr(N);
+    const uint64_t start = lfsr.state;
+    for (i = 1; i < P; i++) {
+      lfsr.step();
+      if (lfsr.state == start) break;
+    }
+    lfsr.step();
+    if (i != P || lfsr.state != start) errors++;
+  }
+  const double h[3] = {0.9, -0.4, 0.1};
+  for (N = 20; N <= 22; N += 2) {  // 32 bit tables, then no tables
+    const long P = (1L << N) - 1;
+    mlsgen_t *gen = mlsgen_create(N, 48000, 48000, 2);
+    const float *mls = mlsgen_mls(gen);
+    float *period = new float[P];
+    float *ir = new float[P + 1];
+    for (i = 0; i < P; i++) {
+      period[i] = 0;
+      for (k = 0; k < 3; k++) period[i] += h[k] * mls[(i - k + P) % P];
+    }
+    mlsgen_set_recording(gen, period);
+    mlsgen_impulse_response(gen, ir);
+    for (i = 0; i < P; i++) {
+      if (fabs(ir[i] - (i < 3 ? h[i] : 0)) > 1e-4) errors++;
+    }
+    const long tables = (P + 1) * 8;
+    if (N > kMaxTableOrder ? mlsgen_plan_bytes(gen) >= tables
+                           : mlsgen_plan_bytes(gen) < tables) {
+      errors++;
+    }
+    mlsgen_destroy(gen);
+    delete[] period;
+    delete[] ir;
+  }
+  if (mlsgen_create(kMinMlsOrder - 1, 48000, 48000, 1) != nullptr) errors++;
+  mlsgen_release_cached_plans();
+  printf("High order mismatches: %ld\n", errors);
+  return errors;
+}
+
+long CheckSpecializedOrders() {
+  long N, i, errors = 0;
+  ThreadPool pool(3);
+  // the highest orders are only checked for their dispatch below
+  for (N = kMinSpecializedOrder; N <= kMaxTableOrder + 2; N++) {
+    const long n = 1L << N;
+    const long P = n - 1;
+    std::vector<uint64_t> mls(packedWords(P));
+    std::vector<float> signal(P), work(n), expected(n), resp(n);
+    std::vector<float> scratch(fhtScratchSize<float>(N) * 3 + 1);
+    long unitTags[kMaxMlsOrder];
+    generatePackedMls(N, mls.data());
+    findUnitTags(mls.data(), N, unitTags);
+    for (i = 0; i < P; i++) signal[i] = (i * 7919) % 1000 / 1000.0f - 0.5f;
+    deconvolveMlsOnTheFly(signal.data(), mls.data(), unitTags, N, work.data(),
+                          scratch.data(), expected.data());
+    // the same sums in the same order, so the responses match exactly
+    for (ThreadPool *threads : {(ThreadPool *)nullptr, &pool}) {
+      onTheFlyKernel<float>(N)(signal.data(), mls.data(), unitTags, N,
+                               work.data(), scratch.data(), resp.data(),
+                               threads);
+      for (i = 0; i <= P; i++) errors += resp[i] != expected[i];
+    }
+  }
+  // every order run table-free by default has its specialization
+  for (N = kMinMlsOrder; N <= kMaxMlsOrder; N++) {
+    const bool generic = onTheFlyKernel<float>(N) ==
+                         &deconvolveMlsOnTheFly<float, RuntimeMlsOrder>;
+    if (generic != (N < kMinSpecializedOrder)) errors++;
+    if (resolveTagStorage(kTagsAuto, N) == kTagsOnTheFly && generic) errors++;
+  }
+  printf("Specialized order mismatches: %ld\n", errors);
+  return errors;
+}
+
+long CheckFrequencyResponse() {
+  const double sampleRate = 48000;
+  long i, k, errors = 0;
+  // a scaled impulse is flat, two equal taps cancel at Nyquist
+  std::vector<float> ir(300, 0.0f), frequencies(257), gains(257);
+  ir[0] = 0.5f;
+  if (mlsgen_frequency_response_bins(300) != 257) errors++;
+  mlsgen_frequency_response(ir.data(), 300, sampleRate, frequencies.data(),
+                            gains.data());
+  for (k = 0; k < 257; k++) {
+    if (fabs(frequencies[k] - k * sampleRate / 512) > 1e-3) errors++;
+    if (fabs(gains[k] - 20 * log10(0.5)) > 1e-4) errors++;
+  }
+  ir[1] = 0.5f;
+  mlsgen_frequency_response(ir.data(), 300, sampleRate, frequencies.data(),
+                            gains.data());
+  if (fabs(gains[0]) > 1e-4 || gains[256] > -100) errors++;
+
+  // a gain curve with a bump at 1 kHz and a low-frequency roll-off
+  const float curveHz[6] = {20, 200, 1000, 5000, 12000, 24000};
+  const float curveDb[6] = {-20, -6, 3, 0, -4, -10};
+  if (fabs(mlsgen_gain_at_frequency(curveHz, curveDb, 6, 1000) - 3) > 1e-6 ||
+      fabs(mlsgen_gain_at_frequency(curveHz, curveDb, 6, 3000) - 1.5) > 1e-6 ||
+      mlsgen_gain_at_frequency(curveHz, curveDb, 6, 5) != -20 ||
+      mlsgen_gain_at_frequency(curveHz, curveDb, 6, 30000) != -10) {
+    errors++;
+  }
+  const long length = 2047;
+  const long bins = mlsgen_frequency_response_bins(length);
+  frequencies.resize(bins);
+  gains.resize(bins);
+  long peaks[2];
+  for (int phase = MLSGEN_PHASE_LINEAR; phase <= MLSGEN_PHASE_MINIMUM;
+       phase++) {
+    ir.assign(length, 0.0f);
+    mlsgen_impulse_response_from_gains(curveHz, curveDb, 6, sampleRate, length,
+                                       phase, ir.data());
+    mlsgen_frequency_response(ir.data(), length, sampleRate,
+                              frequencies.data(), gains.data());
+    for (k = 0; k < bins; k++) {
+      if (frequencies[k] < 300 || frequencies[k] > 20000) continue;
+      const double expected =
+          mlsgen_gain_at_frequency(curveHz, curveDb, 6, frequencies[k]);
+      if (fabs(gains[k] - expected) > 0.5) errors++;
+    }
+    peaks[phase] = 0;
+    for (i = 1; i < length; i++) {
+      if (fabs(ir[i]) > fabs(ir[peaks[phase]])) peaks[phase] = i;
+    }
+  }
+  // linear phase is centered, minimum phase starts right away
+  if (peaks[MLSGEN_PHASE_LINEAR] != length / 2 ||
+      peaks[MLSGEN_PHASE_MINIMUM] > 16) {
+    errors++;
+  }
+  printf("Frequency response mismatches: %ld\n", errors);
+  return errors;
+}
+
+long CheckPsd() {
+  const double sampleRate = 48000;
+  const long n = 1L << 18;
+  const long maxSegment = 4096;
+  const long bins = mlsgen_psd_bins(n, maxSegment);
+  std::vector<float> x(n), frequencies(bins), psd(bins);
+  long i, k, errors = 0;
+  if (bins != maxSegment / 2 + 1 || mlsgen_psd_bins(3000, 0) != 1025) errors++;
+
+  // uniform white noise of variance 1/3 has a one-sided density of
+  // 2 / 3 / sampleRate, plus a DC offset the segment means remove
+  uint32_t seed = 12345;
+  for (i = 0; i < n; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    x[i] = 0.25f + (float)(seed >> 8) / (1 << 23) - 1.0f;
+  }
+  const long segments = mlsgen_psd(x.data(), n, sampleRate, maxSegment,
+                                   frequencies.data(), psd.data());
+  if (segments != 2 * n / maxSegment - 1) errors++;
+  double mean = 0;
+  for (k = 1; k < bins - 1; k++) mean += psd[k];
+  mean /= bins - 2;
+  if (fabs(mean * sampleRate * 3 / 2 - 1) > 0.02) errors++;
+  if (psd[0] > mean) errors++;  // the offset alone: ~250 times the mean
+
+  // a tone on a bin: its power A^2 / 2 spread over the Hann main lobe
+  const double amplitude = 0.5;
+  const long toneBin = 100;
+  const double toneHz = toneBin * sampleRate / maxSegment;
+  for (i = 0; i < n; i++) {
+    x[i] = (float)(amplitude * sin(2 * M_PI * toneHz * i / sampleRate));
+  }
+  mlsgen_psd(x.data(), n, sampleRate, maxSegment, frequencies.data(),
+             psd.data());
+  if (fabs(frequencies[toneBin] - toneHz) > 1e-3) errors++;
+  double power = 0;
+  for (k = toneBin - 2; k <= toneBin + 2; k++) {
+    power += psd[k] * sampleRate / maxSegment;
+  }
+  if (fabs(power / (amplitude * amplitude / 2) - 1) > 0.01) errors++;
+
+  // subtracting a flat -6 dB curve raises the density fourfold
+  const float knownHz[2] = {100, 10000};
+  const float knownDb[2] = {-6, -6};
+  const float before = psd[toneBin];
+  mlsgen_subtract_gains(frequencies.data(), psd.data(), bins, knownHz, knownDb,
+                        2);
+  if (fabs(psd[toneBin] / before - pow(10, 0.6)) > 1e-3) errors++;
+  printf("PSD mismatches: %ld\n", errors);
+  return errors;
+}
+
+long CheckInverseFilter() {
+  const double sampleRate = 48000;
+  const long n = 4096, length = 2048;
+  const long bins = mlsgen_frequency_response_bins(n);
+  std::vector<float> irs(2 * n, 0.0f), frequencies(bins), gains(bins);
+  std::vector<float> iir(length), iirNoBandpass(length);
+  std::vector<float> system(n + length - 1);
+  const long responseBins = mlsgen_frequency_response_bins(n + length - 1);
+  std::vector<float> responseHz(responseBins), responseDb(responseBins);
+  const long inverseBins = mlsgen_frequency_response_bins(length);
+  std::vector<float> inverseHz(inverseBins), inverseDb(inverseBins);
+  mlsgen_inverse_filter_options options = {
+      100, 16000, 40, 0, 0, 0, length, MLSGEN_PHASE_LINEAR};
+  long i, k, errors = 0;
+
+  // two captures of a response with a 6 dB peak and dip
+  for (long c = 0; c < 2; c++) {
+    irs[c * n] = 1;
+    irs[c * n + 1] = 0.3f;
+    irs[c * n + 3] = -0.4f;
+  }
+  for (int phase : {MLSGEN_PHASE_LINEAR, MLSGEN_PHASE_MINIMUM}) {
+    options.phase = phase;
+    double fMaxHz;
+    const double attenuator = mlsgen_inverse_filter(
+        irs.data(), 2, n, sampleRate, nullptr, nullptr, 0, &options,
+        frequencies.data(), gains.data(), nullptr, nullptr, iir.data(),
+        iirNoBandpass.data(), &fMaxHz);
+    // the peak may sit on the roll-off just past an edge
+    if (fMaxHz < options.lowHz / 1.26 || fMaxHz > options.highHz * 1.26) {
+      errors++;
+    }
+    // the inverse leaves the attenuation to the convolution, like the server's
+    mlsgen_frequency_response(iir.data(), length, sampleRate, inverseHz.data(),
+                              inverseDb.data());
+    double peak = -1e30;
+    for (k = 0; k < inverseBins; k++) {
+      if (inverseHz[k] >= options.lowHz && inverseHz[k] <= options.highHz) {
+        peak = fmax(peak, inverseDb[k]);
+      }
+    }
+    if (fabs(peak + attenuator - options.maxBoostDb) > 0.5) errors++;
+
+    // the system through its inverse is flat within the band
+    const float *filters[2] = {iir.data(), iirNoBandpass.data()};
+    for (long f = 0; f < 2; f++) {
+      std::fill(system.begin(), system.end(), 0.0f);
+      for (i = 0; i < length; i++) {
+        for (k = 0; k < 4; k++) system[i + k] += filters[f][i] * irs[k];
+      }
+      mlsgen_frequency_response(system.data(), n + length - 1, sampleRate,
+                                responseHz.data(), responseDb.data());
+      double low = 1e30, high = -1e30, stop = -1e30;
+      for (k = 0; k < responseBins; k++) {
+        if (responseHz[k] >= 200 && responseHz[k] <= 12000) {
+          low = fmin(low, responseDb[k]);
+          high = fmax(high, responseDb[k]);
+        } else if (responseHz[k] >= 22000) {
+          stop = fmax(stop, responseDb[k]);
+        }
+      }
+      if (high - low > 0.5) errors++;
+      // the band-limited inverse stops above the top edge, the other is flat
+      if (f == 0 ? stop > high - 20 : stop < low - 0.5) errors++;
+    }
+    if (phase == MLSGEN_PHASE_MINIMUM) {
+      double early = 0, total = 0;
+      for (i = 0; i < length; i++) {
+        total += iir[i] * iir[i];
+        if (i < length / 10) early += iir[i] * iir[i];
+      }
+      if (early < 0.9 * total) errors++;
+    }
+  }
+
+  // a known +6 dB component is taken out of the measured gains, and the
+  // inverse of the rest needs 6 dB less attenuation
+  const float knownHz[2] = {0, 24000};
+  const float knownDb[2] = {6, 6};
+  std::vector<float> lessKnown(bins);
+  const double attenuator = mlsgen_inverse_filter(
+      irs.data(), 2, n, sampleRate, nullptr, nullptr, 0, &options,
+      frequencies.data(), gains.data(), nullptr, nullptr, iir.data(),
+      iirNoBandpass.data(), nullptr);
+  const double attenuatorLessKnown = mlsgen_inverse_filter(
+      irs.data(), 2, n, sampleRate, knownHz, knownDb, 2, &options,
+      frequencies.data(), lessKnown.data(), nullptr, nullptr, iir.data(),
+      iirNoBandpass.data(), nullptr);
+  if (fabs(gains[bins / 3] - lessKnown[bins / 3] - 6) > 1e-3) errors++;
+  if (fabs(attenuatorLessKnown - attenuator + 6) > 1e-3) errors++;
+
+  // a component {1, 0.5} measured through a minimum-phase microphone
+  // {1, -0.3} known by its gains: the component keeps its own phase
+  std::vector<float> system1(n, 0.0f), microphone(n, 0.0f);
+  std::vector<float> micHz(bins), micDb(bins), angles(bins), component(bins);
+  system1[0] = 1, system1[1] = 0.2f, system1[2] = -0.15f;
+  microphone[0] = 1, microphone[1] = -0.3f;
+  mlsgen_frequency_response(microphone.data(), n, sampleRate, micHz.data(),
+                            micDb.data());
+  mlsgen_inverse_filter(system1.data(), 1, n, sampleRate, micHz.data(),
+                        micDb.data(), bins, &options, frequencies.data(),
+                        gains.data(), angles.data(), component.data(),
+                        iir.data(), iirNoBandpass.data(), nullptr);
+  double worst = 0, apart = 0;
+  for (k = 1; k < bins - 1; k++) {
+    const double w = 2 * M_PI * frequencies[k] / sampleRate;
+    const double expected = atan2(-0.5 * sin(w), 1 + 0.5 * cos(w));
+    worst = fmax(worst, fabs(component[k] - expected));
+    apart = fmax(apart, fabs(angles[k] - expected));
+  }
+  if (worst > 0.01 || apart < 0.1) errors++;
+  printf("Inverse filter mismatches: %ld\n", errors);
+  return errors;
+}
+
+long CheckConvolution() {
+  const long length = 10000, block = 64, n = 20000;
+  std::vector<float> h(length), x(n), direct(n, 0.0f), y(n);
+  long i, m, errors = 0;
+
+  uint32_t seed = 777;
+  for (i = 0; i < length; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    h[i] = ((float)(seed >> 8) / (1 << 23) - 1.0f) * expf(-i / 2000.0f);
+  }
+  for (i = 0; i < n; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    x[i] = (float)(seed >> 8) / (1 << 23) - 1.0f;
+  }
+  for (i = 0; i < n; i++) {
+    double sum = 0;
+    for (m = 0; m < length && m <= i; m++) sum += (double)h[m] * x[i - m];
+    direct[i] = (float)sum;
+  }
+  if (mlsgen_convolver_create(h.data(), length, 100, 1) ||
+      mlsgen_convolver_create(h.data(), 0, block, 1)) {
+    errors++;
+  }
+
+  // uniform and non-uniform partitions give the direct convolution, in
+  // blocks and again after a reset
+  for (int nonUniform = 0; nonUniform < 2; nonUniform++) {
+    mlsgen_convolver_t *convolver =
+        mlsgen_convolver_create(h.data(), length, block, nonUniform);
+    if (mlsgen_convolver_block(convolver) != block) errors++;
+    for (int pass = 0; pass < 2; pass++) {
+      mlsgen_convolver_reset(convolver);
+      for (i = 0; i + block <= n; i += block) {
+        mlsgen_convolver_process(convolver, &x[i], &y[i]);
+      }
+      double worst = 0;
+      for (i = 0; i < n / block * block; i++) {
+        worst = fmax(worst, fabs(y[i] - direct[i]));
+      }
+      if (worst > 1e-3) errors++;
+    }
+    mlsgen_convolver_destroy(convolver);
+  }
+
+  // a looped MLS-like period through the filter: from the start it is the
+  // linear convolution of the repeated signal, settled it is circular
+  const long period = 4095;
+  std::vector<float> looped(3 * period), circular(period, 0.0f);
+  for (i = 0; i < 3 * period; i++) looped[i] = x[i % period];
+  mlsgen_convolve_looped(x.data(), period, h.data(), length, 0.5f, 0, y.data(),
+                         3 * period);
+  double worst = 0;
+  for (i = 0; i < 3 * period; i++) {
+    double sum = 0;
+    for (m = 0; m < length && m <= i; m++) sum += (double)h[m] * looped[i - m];
+    worst = fmax(worst, fabs(y[i] - 0.5 * sum));
+  }
+  if (worst > 1e-3) errors++;
+  for (i = 0; i < period; i++) {
+    double sum = 0;
+    for (m = 0; m < length; m++) {
+      sum += (double)h[m] * x[((i - m) % period + period) % period];
+    }
+    circular[i] = (float)sum;
+  }
+  mlsgen_convolve_looped(x.data(), period, h.data(), length, 1, 1, y.data(),
+                         2 * period);
+  worst = 0;
+  for (i = 0; i < 2 * period; i++) {
+    worst = fmax(worst, fabs(y[i] - circular[i % period]));
+  }
+  if (worst > 1e-3) errors++;
+  if (mlsgen_convolve_looped(x.data(), 0, h.data(), length, 1, 1, y.data(),
+                             1)) {
+    errors++;
+  }
+  printf("Convolution mismatches: %ld\n", errors);
+  return errors;
+}
+
+long CheckVolume() {
+  const long sampleRate = 48000;
+  const double lCalib = 104.92978421490648;
+  const long n = 6 * sampleRate;
+  const double amplitude = 0.1, second = 0.001, third = 0.0005;
+  std::vector<float> x(n);
+  long i, errors = 0;
+
+  // 1 kHz with 2nd and 3rd harmonics, silent outside the target range
+  for (i = 0; i < n; i++) {
+    const double t = (double)i / sampleRate;
+    const bool on = t >= Volume::TARGET_RANGE[0] && t < Volume::TARGET_RANGE[1];
+    x[i] = on ? (float)(amplitude * sin(2 * M_PI * 1000 * t) +
+                        second * sin(2 * M_PI * 2000 * t + 0.3) +
+                        third * sin(2 * M_PI * 3000 * t + 1.1))
+              : 0.0f;
+  }
+  Volume volume(sampleRate, lCalib);
+  volume.analyzeCapture(x.data(), n);
+  const double rmsDb = 10 * log10((amplitude * amplitude + second * second +
+                                   third * third) / 2);
+  const double thd = 100 * hypot(second, third) / amplitude;
+  if (fabs(volume.getOutDbSPL() - (lCalib + rmsDb)) > 1e-3) errors++;
+  if (fabs(volume.getOutDbSPL1000() -
+           (lCalib + 20 * log10(amplitude / sqrt(2)))) > 1e-3) {
+    errors++;
+  }
+  if (fabs(volume.getThd() - thd) > 1e-3 * thd) errors++;
+  if (volume.getHarmonics()[3] > 1e-6) errors++;
+
+  // a fraction of a cycle too many: the window keeps the level within 0.1 dB
+  volume.analyze(x.data() + 3 * sampleRate + sampleRate / 2, 4321);
+  if (fabs(volume.getOutDbSPL1000() -
+           (lCalib + 20 * log10(amplitude / sqrt(2)))) > 0.1) {
+    errors++;
+  }
+  printf("Volume: %.3f dB SPL, %.3f dB SPL at 1000 Hz, THD %.4f%%, "
+         "mismatches: %ld\n",
+         volume.getOutDbSPL(), volume.getOutDbSPL1000(), volume.getThd(),
+         errors);
+  return errors;
+}
+
+long CheckVolumeFit() {
+  const VolumeParameters truth = {-15, 8, 3, 100, 45, 0};
+  const double inDb[9] = {-60, -50, -40, -30, -20, -15, -10, -5, -3.1};
+  double outDbSPL[9];
+  long i, errors = 0;
+
+  // the model's derivatives against central differences
+  const double h = 1e-6;
+  const double p[5] = {truth.T, truth.W, truth.R, truth.gainDBSPL,
+                       truth.backgroundDBSPL};
+  const VolumeModel model = {inDb, outDbSPL};
+  double gradient[5], unused[5], up[5], down[5];
+  for (i = 0; i < 9; i++) outDbSPL[i] = soundLevelModelDb(inDb[i], truth);
+  for (i = 0; i < 9; i++) {
+    model.residual(i, p, gradient);
+    for (long k = 0; k < 5; k++) {
+      std::copy(p, p + 5, up);
+      std::copy(p, p + 5, down);
+      up[k] += h;
+      down[k] -= h;
+      const double slope =
+          (model.residual(i, up, unused) - model.residual(i, down, unused)) /
+          (2 * h);
+      if (fabs(slope - gradient[k]) > 1e-5) errors++;
+    }
+  }
+
+  // cold, then warm from a nearby device
+  const VolumeParameters cold =
+      fitVolumeParameters(inDb, outDbSPL, 9, nullptr);
+  const VolumeParameters previous = {-12, 5, 2.5, 97, 40, 0};
+  const VolumeParameters warm =
+      fitVolumeParameters(inDb, outDbSPL, 9, &previous);
+  for (const VolumeParameters &fit : {cold, warm}) {
+    if (fit.RMSError > 1e-4) errors++;
+    if (fabs(fit.T - truth.T) > 0.05 || fabs(fit.W - truth.W) > 0.05 ||
+        fabs(fit.R - truth.R) > 0.01 ||
+        fabs(fit.gainDBSPL - truth.gainDBSPL) > 0.01 ||
+        fabs(fit.backgroundDBSPL - truth.backgroundDBSPL) > 0.05) {
+      errors++;
+    }
+  }
+  printf("Volume fit: T %.3f W %.3f R %.3f gain %.3f background %.3f, "
+         "RMS error %.2g dB, mismatches: %ld\n",
+         cold.T, cold.W, cold.R, cold.gainDBSPL, cold.backgroundDBSPL,
+         cold.RMSError, errors);
+  return errors;
+}
+
+long CheckOnset() {
+  const long N = 14;
+  const long P = (1 << N) - 1;
+  const long delay = 1234;
+  const long length = delay + 3 * P;
+  const double h[3] = {-1.5, 0.3, 0.1};  // inverted polarity
+  long i, k, errors = 0;
+  float *capture = new float[length];
+  mlsgen_t *gen = mlsgen_create(N, 48000, 48000, 1);
+  const float *mls = mlsgen_mls(gen);
+  for (i = 0; i < length; i++) {
+    capture[i] = 0;
+    for (k = 0; k < 3 && i - k >= delay; k++) {
+      capture[i] += h[k] * mls[(i - k - delay) % P];
+    }
+  }
+  const double onset = mlsgen_estimate_onset(gen, capture, length);
+  if (fabs(onset - delay) > 0.25) errors++;
+  if (mlsgen_estimate_onset(gen, capture, P - 1) != -1) errors++;
+  mlsgen_destroy(gen);
+  delete[] capture;
+  printf("Onset error: %g samples\n", onset - delay);
+  return errors;
+}
+
+long CheckDrift() {
+  const long N = 14;
+  const long P = (1 << N) - 1;
+  const long periods = 6;
+  const double ratio = 1.0002;  // sink clock 200 ppm fast
+  const double delay = 321.4;
+  long i, errors = 0;
+  mlsgen_t *gen = mlsgen_create(N, 48000, 48000, 1);
+  float *played = new float[periods * P];
+  for (i = 0; i < periods * P; i++) played[i] = mlsgen_mls(gen)[i % P];
+  // record the periodic MLS on the drifting clock, after a delay
+  SincResampler recorder(1 / ratio);
+  const long length = (long)(delay + (periods - 1) * P * ratio);
+  float *capture = new float[length];
+  recorder.process(played, periods * P, -delay / ratio, capture, length);
+  const double estimate = mlsgen_estimate_clock_ratio(gen, capture, length);
+  if (fabs(estimate - ratio) > 1e-6) errors++;
+  // drift corrected, the response is a unit impulse, band limited to 0.97 of
+  // Nyquist by the recording and again by the correction
+  float *resp = new float[P + 1];
+  if (mlsgen_average_drift_corrected(gen, capture, length, 4, 0) != 4) {
+    errors++;
+  }
+  mlsgen_impulse_response(gen, resp);
+  const double peak = resp[0];
+  if (fabs(peak - 1) > 0.1) errors++;
+  for (i = 1; i < P; i++) {
+    if (fabs(resp[i]) > 0.1) errors++;
+  }
+  mlsgen_destroy(gen);
+  delete[] played;
+  delete[] capture;
+  delete[] resp;
+  printf("Clock ratio error: %g ppm, impulse peak %g\n",
+         (estimate - ratio) * 1e6, peak);
+  return errors;
+}
+
+long CheckStream() {
+  const long N = 12;
+  const long P = (1 << N) - 1;
+  const long delay = 700;
+  const long length = delay + 5 * P + 100;
+  const double h[3] = {0.8, -0.3, 0.2};
+  long i, k, errors = 0, periods = 0;
+  mlsgen_t *gen = mlsgen_create(N, 48000, 48000, 1);
+  const float *mls = mlsgen_mls(gen);
+  float *capture = new float[length];
+  float *resp = new float[P + 1];
+  for (i = 0; i < length; i++) {
+    capture[i] = 0.01f * ((i * 7919) % 101 / 50.0f - 1);  // a little noise
+    for (k = 0; k < 3 && i - k >= delay; k++) {
+      capture[i] += h[k] * mls[(i - k - delay) % P];
+    }
+  }
+  // blocks of an awkward size, onset found from the stream itself
+  mlsgen_stream_start(gen, -1);
+  for (i = 0; i < length; i += 333) {
+    const long n = i + 333 < length ? 333 : length - i;
+    if (mlsgen_stream_push(gen, capture + i, n) > 0) {
+      periods++;
+      mlsgen_stream_impulse_response(gen, resp);
+    }
+  }
+  if (periods != 5 || mlsgen_stream_periods(gen) != 5) errors++;
+  const double change = mlsgen_stream_impulse_response(gen, resp);
+  for (i = 0; i < P; i++) {
+    if (fabs(resp[i] - (i < 3 ? h[i] : 0)) > 0.01) errors++;
+  }
+  if (change < 0 || change > 1e-3) errors++;
+  mlsgen_destroy(gen);
+  delete[] capture;
+  delete[] resp;
+  printf("Stream mismatches: %ld\n", errors);
+  return errors;
+}
+
+// Check that input slots are reused unless a capture outgrows them
+long CheckInputArena() {
+  InputArena arena;
+  long errors = 0;
+  float *capture = arena.slot(0, 1000);
+  float *block = arena.slot(2, 128);
+  capture[999] = 1;
+  if (arena.slot(0, 1000) != capture || arena.slot(0, 10) != capture) errors++;
+  if (arena.slot(2, 128) != block || arena.data(0) != capture) errors++;
+  if (capture[999] != 1 || arena.data(1) != nullptr) errors++;
+  if (arena.bytes() != 1128 * (long)sizeof(float)) errors++;
+  if (arena.slot(0, 1200) == nullptr || arena.bytes() < 1628 * 4) errors++;
+  arena.release();
+  if (arena.bytes() != 0 || arena.data(0) != nullptr) errors++;
+  printf("Input arena mismatches: %ld\n", errors);
+  return errors;
+}
+
+// Check that arena arrays are aligned and blocks are recycled through the pool
+long CheckWorkArena() {
+  long errors = 0;
+  WorkArena::releaseUnused();
+  const long bytes = WorkArena::bytesFor<float>(1001) +
+                     WorkArena::bytesFor<double>(3);
+  WorkArena arena(bytes);
+  float *a = arena.take<float>(1001);
+  double *b = arena.take<double>(3);
+  if ((uintptr_t)a % WorkArena::kAlignment || (uintptr_t)b % 64) errors++;
+  if (arena.take<char>(1) != nullptr) errors++;  // sized exactly
+  arena.release();
+  WorkArena again(bytes - 64);  // fits the pooled block
+  if (again.take<float>(1) != a) errors++;
+  WorkArena larger(4 * bytes);  // too small to reuse, a new block
+  if (larger.take<float>(1) == a || larger.size() < 4 * bytes) errors++;
+  const long held = again.size() + larger.size();
+  again.release();
+  larger.release();
+  if (WorkArena::pooledBytes() != held) errors++;
+  // a block over the pool's limit is freed, not held
+  WorkArena huge(WorkArena::kMaxPooledBytes + 64);
+  huge.release();
+  if (WorkArena::pooledBytes() > WorkArena::kMaxPooledBytes) errors++;
+  if (WorkArena::releaseUnused() != 2) errors++;
+  if (WorkArena::pooledBytes() != 0) errors++;
+  printf("Work arena mismatches: %ld\n", errors);
+  return errors;
+}
+
 int main() {
   const long N = 18;
   const long P = (1 << N) - 1;
@@ -170,6 +1039,7 @@ int main() {
   for (i = 0; i < 10; i++) printf("%f\n", perm[i]);
   printf("Impulse response:\n");
   for (i = 0; i < 10; i++) printf("%10.5f\n", resp[i]);
+  const long apiErrors = CheckCApi(signal, resp, N);
   delete[] mls;
   delete[] tagL;
   delete[] tagS;
@@ -177,5 +1047,13 @@ int main() {
   delete[] perm;
   delete[] resp;
 
-  return 0;
+  const long errors = CheckPackedMls() + CheckTags() + CheckHadamard() +
+                      CheckThreads() + CheckOnset() + CheckDrift() +
+                      CheckStream() + CheckInputArena() +
+                      CheckWorkArena() + CheckTagStorage() +
+                      CheckHighOrders() + CheckSpecializedOrders() +
+                      CheckFrequencyResponse() + CheckPsd() +
+                      CheckInverseFilter() + CheckConvolution() +
+                      CheckVolume() + CheckVolumeFit() + apiErrors;
+  return errors == 0 ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,191 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSPLAN_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSPLAN_HPP_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "hadamard.hpp"
+#include "lfsr.hpp"
+#include "tags.hpp"
+#include "threadPool.hpp"
+#include "workArena.hpp"
+
+/**
+ * @brief Everything about an MLS of order N that does not depend on the
+ * recording: the packed sequence, the inverse tagS/tagL permutations and the
+ * scratch sizes of the Hadamard transform. A plan is immutable once built and
+ * shared (reference counted) by every MLSGen of the same order and tag
+ * storage, so creating an MLSGen costs an allocation rather than a
+ * recomputation.
+ *
+ * The tag tables hold 16 or 32 bit indices (see TagStorage), or are left out
+ * altogether for kTagsOnTheFly, where the plan only keeps the packed sequence
+ * and the N positions a TagCursor needs to regenerate the tags.
+ */
+class MLSPlan {
+ public:
+  const long N;  // mls factor
+  const long P;  // len of mls
+  const long fhtScratchFloat;   // fhtScratchSize<float>(N)
+  const long fhtScratchDouble;  // fhtScratchSize<double>(N)
+  const TagStorage tagStorage;  // resolved, never kTagsAuto
+
+  /**
+   * @brief Get the plan for order N from the module-wide cache, building it
+   * on first use.
+   *
+   * @param N - number of bits
+   * @param pool - threads to build the permutation tables with, or nullptr
+   * @param storage - how to store the tag tables (see TagStorage)
+   */
+  static std::shared_ptr<const MLSPlan> get(long N,
+                                            ThreadPool *pool = nullptr,
+                                            TagStorage storage = kTagsAuto);
+
+  /**
+   * @brief Drop the cached plans that no MLSGen is using anymore.
+   *
+   * @return long - number of plans released
+   */
+  static long releaseUnused();
+
+  const uint64_t *mls() const { return mlsBits; }
+
+  /**
+   * @brief Inverse tag tables, P + 1 entries of Index; nullptr unless Index
+   * matches the tag storage of the plan.
+   */
+  template <typename Index>
+  const Index *tagLInv() const {
+    return sizeof(Index) == tagStorageBytes(tagStorage)
+               ? static_cast<const Index *>(tagLInverse)
+               : nullptr;
+  }
+  template <typename Index>
+  const Index *tagSInv() const {
+    return sizeof(Index) == tagStorageBytes(tagStorage)
+               ? static_cast<const Index *>(tagSInverse)
+               : nullptr;
+  }
+
+  /**
+   * @brief Positions of the power of two tags (see findUnitTags).
+   */
+  const long *unitTags() const { return unitTagPositions; }
+
+  /**
+   * @brief Bytes of the sequence and tag tables.
+   */
+  long tableBytes() const { return tables.size(); }
+
+  MLSPlan(long N, ThreadPool *pool = nullptr, TagStorage storage = kTagsAuto);
+  MLSPlan(const MLSPlan &) = delete;
+  MLSPlan &operator=(const MLSPlan &) = delete;
+
+ private:
+  WorkArena tables;   // one aligned block holding the three arrays below
+  uint64_t *mlsBits;  // packed MLS bits, LSB first
+  void *tagLInverse;  // inverse tagL permutation, P + 1 entries
+  void *tagSInverse;  // inverse tagS permutation, P + 1 entries
+  long unitTagPositions[kMaxMlsOrder];
+
+  template <typename Index>
+  void buildTags(Index *tagLInv, Index *tagSInv, ThreadPool *pool);
+
+  static std::mutex &cacheMutex();
+  static std::map<long, std::shared_ptr<const MLSPlan>> &cache();
+};
+
+inline MLSPlan::MLSPlan(long N, ThreadPool *pool, TagStorage storage)
+    : N(N),
+      P((1L << N) - 1),
+      fhtScratchFloat(fhtScratchSize<float>(N)),
+      fhtScratchDouble(fhtScratchSize<double>(N)),
+      tagStorage(resolveTagStorage(storage, N)),
+      tables(WorkArena::bytesFor<uint64_t>(packedWords(P)) +
+             2 * WorkArena::bytesFor<char>((P + 1) *
+                                           tagStorageBytes(tagStorage))) {
+  const long tagBytes = (P + 1) * tagStorageBytes(tagStorage);
+  mlsBits = tables.take<uint64_t>(packedWords(P));
+  tagLInverse = tagBytes ? tables.take<char>(tagBytes) : nullptr;
+  tagSInverse = tagBytes ? tables.take<char>(tagBytes) : nullptr;
+  generatePackedMls(N, mlsBits);
+  if (tagStorage == kTagsUint16) {
+    buildTags(static_cast<uint16_t *>(tagLInverse),
+              static_cast<uint16_t *>(tagSInverse), pool);
+  } else if (tagStorage == kTagsUint32) {
+    buildTags(static_cast<uint32_t *>(tagLInverse),
+              static_cast<uint32_t *>(tagSInverse), pool);
+  } else {
+    findUnitTags(mlsBits, N, unitTagPositions);
+  }
+}
+
+template <typename Index>
+inline void MLSPlan::buildTags(Index *tagLInv, Index *tagSInv,
+                               ThreadPool *pool) {
+  if (poolSize(pool) == 1) {
+    generateTagLInverse(tagLInv, N);
+    generateTagSInverse(mlsBits, tagSInv, N);
+  } else {
+    // Both tables split into independent ranges: tagS windows restart from
+    // the samples before the range, tagL tags are seeked from tagSInv.
+    const long chunks = 4 * pool->size();
+    const long chunk = (P + chunks - 1) / chunks;
+    tagSInv[0] = (Index)P;
+    tagLInv[0] = (Index)P;
+    parallelFor(pool, chunks, [&](long c, long) {
+      const long begin = c * chunk;
+      const long end = begin + chunk < P ? begin + chunk : P;
+      if (begin < end) generateTagSInverse(mlsBits, tagSInv, N, begin, end);
+    });
+    parallelFor(pool, chunks, [&](long c, long) {
+      const long begin = c * chunk;
+      const long end = begin + chunk < P ? begin + chunk : P;
+      long ring[kMaxMlsOrder];
+      if (begin >= end) return;
+      seekTagL(mlsBits, tagSInv, N, begin, ring);
+      generateTagLInverse(ring, tagLInv, N, begin, end);
+    });
+  }
+  for (long j = 0; j < N; j++) unitTagPositions[j] = (long)tagSInv[1L << j];
+}
+
+inline std::mutex &MLSPlan::cacheMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+inline std::map<long, std::shared_ptr<const MLSPlan>> &MLSPlan::cache() {
+  static std::map<long, std::shared_ptr<const MLSPlan>> plans;
+  return plans;
+}
+
+inline std::shared_ptr<const MLSPlan> MLSPlan::get(long N,
+                                                   ThreadPool *pool,
+                                                   TagStorage storage) {
+  const TagStorage resolved = resolveTagStorage(storage, N);
+  std::lock_guard<std::mutex> lock(cacheMutex());
+  std::shared_ptr<const MLSPlan> &plan = cache()[N * 4 + resolved];
+  if (!plan) plan = std::make_shared<const MLSPlan>(N, pool, resolved);
+  return plan;
+}
+
+inline long MLSPlan::releaseUnused() {
+  std::lock_guard<std::mutex> lock(cacheMutex());
+  long released = 0;
+  for (auto it = cache().begin(); it != cache().end();) {
+    if (it->second.use_count() == 1) {
+      it = cache().erase(it);
+      released++;
+    } else {
+      ++it;
+    }
+  }
+  return released;
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_MLSPLAN_HPP_
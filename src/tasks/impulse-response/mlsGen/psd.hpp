@@ -0,0 +1,208 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_PSD_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_PSD_HPP_
+
+#include <math.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "correlation.hpp"
+#include "frequencyResponse.hpp"
+#include "simd.hpp"
+
+// Longest Welch segment by default: 2^15 samples, 1.5 Hz bins at 48 kHz
+const long kMaxWelchSegment = 1L << 15;
+
+/**
+ * @brief Segment length of the Welch estimate of n samples: the largest
+ * power of two up to both n and maxSegment (at least 2).
+ */
+inline long welchSegmentLength(long n, long maxSegment) {
+  const long limit = n < maxSegment ? n : maxSegment;
+  long segment = 2;
+  while (segment * 2 <= limit) segment *= 2;
+  return segment;
+}
+
+/**
+ * @brief Number of frequencies welchPsd gives for n samples.
+ */
+inline long welchBins(long n, long maxSegment) {
+  return welchSegmentLength(n, maxSegment) / 2 + 1;
+}
+
+/**
+ * @brief Periodic Hann window and real FFT plan of one Welch segment length.
+ * Like RealFftPlan, plans are cached per length and shared.
+ */
+class WelchPlan {
+ public:
+  const long segment;
+  const std::shared_ptr<const RealFftPlan> fft;
+  std::vector<float> window;
+  double windowPower;  // sum of the squared window
+
+  /**
+   * @brief Get the plan for segments of segment samples from the
+   * module-wide cache, building it on first use.
+   */
+  static std::shared_ptr<const WelchPlan> get(long segment) {
+    std::lock_guard<std::mutex> lock(cacheMutex());
+    std::shared_ptr<const WelchPlan> &plan = cache()[segment];
+    if (!plan) plan = std::make_shared<const WelchPlan>(segment);
+    return plan;
+  }
+
+  /**
+   * @brief Drop the cached plans nothing is using anymore.
+   *
+   * @return long - number of plans released
+   */
+  static long releaseUnused() {
+    std::lock_guard<std::mutex> lock(cacheMutex());
+    long released = 0;
+    for (auto it = cache().begin(); it != cache().end();) {
+      if (it->second.use_count() == 1) {
+        it = cache().erase(it);
+        released++;
+      } else {
+        ++it;
+      }
+    }
+    return released;
+  }
+
+  explicit WelchPlan(long segment)
+      : segment(segment),
+        fft(RealFftPlan::get(segment)),
+        window(segment),
+        windowPower(0) {
+    for (long i = 0; i < segment; i++) {
+      const double w = 0.5 - 0.5 * cos(2 * M_PI * i / segment);
+      window[i] = (float)w;
+      windowPower += w * w;
+    }
+  }
+
+ private:
+  static std::mutex &cacheMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  static std::map<long, std::shared_ptr<const WelchPlan>> &cache() {
+    static std::map<long, std::shared_ptr<const WelchPlan>> plans;
+    return plans;
+  }
+};
+
+/**
+ * @brief out[i] = (x[i] - mean) * window[i] for n samples.
+ */
+inline void detrendAndWindow(const float *x, float mean, const float *window,
+                             long n, float *out) {
+  typedef Vec<float> V;
+  const typename V::type m = V::splat(mean);
+  long i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(out + i,
+             V::mul(V::sub(V::load(x + i), m), V::load(window + i)));
+  }
+  for (; i < n; i++) out[i] = (x[i] - mean) * window[i];
+}
+
+/**
+ * @brief acc[i] += x[i] * x[i] for n values; over the interleaved bins of a
+ * real FFT it accumulates re^2 and im^2 side by side.
+ */
+inline void accumulateSquares(float *acc, const float *x, long n) {
+  typedef Vec<float> V;
+  long i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    const typename V::type v = V::load(x + i);
+    V::store(acc + i, V::add(V::load(acc + i), V::mul(v, v)));
+  }
+  for (; i < n; i++) acc[i] += x[i] * x[i];
+}
+
+/**
+ * @brief One-sided power spectral density by Welch's method, as
+ * scipy.signal.welch with its defaults: periodic Hann segments overlapping by
+ * half, each with its mean removed, averaged and scaled to a density
+ * (units^2 / Hz).
+ *
+ * The segments share one cached window and FFT plan, and their squared bins
+ * are summed with SIMD in the interleaved layout kissfft returns them in.
+ *
+ * @param x - n samples, at least 1
+ * @param n - length of x
+ * @param sampleRate - sampling rate of x in Hz
+ * @param maxSegment - longest segment, see welchSegmentLength
+ * @param frequencies - welchBins(n, maxSegment) frequencies in Hz
+ * @param psd - welchBins(n, maxSegment) densities
+ * @return long - number of segments averaged
+ */
+inline long welchPsd(const float *x, long n, double sampleRate,
+                     long maxSegment, float *frequencies, float *psd) {
+  const long segment = welchSegmentLength(n, maxSegment);
+  const long step = segment / 2;
+  const long bins = segment / 2 + 1;
+  std::shared_ptr<const WelchPlan> plan = WelchPlan::get(segment);
+  std::vector<float> buffer(segment, 0.0f);
+  std::vector<kiss_fft_cpx> X(bins);
+  std::vector<float> acc(2 * bins, 0.0f);
+  long segments = 0;
+  long i, k;
+
+  for (long start = 0; start + segment <= n || segments == 0;
+       start += step, segments++) {
+    // a single zero-padded segment when x is a single sample
+    const long length = start + segment <= n ? segment : n - start;
+    double mean = 0;
+    for (i = 0; i < length; i++) mean += x[start + i];
+    mean /= length;
+    detrendAndWindow(x + start, (float)mean, plan->window.data(), length,
+                     buffer.data());
+    plan->fft->forward(buffer.data(), X.data());
+    accumulateSquares(acc.data(), reinterpret_cast<const float *>(X.data()),
+                      2 * bins);
+  }
+  const double scale = 1 / (sampleRate * plan->windowPower * segments);
+  for (k = 0; k < bins; k++) {
+    // every bin but DC and Nyquist also holds its negative frequency
+    const double side = k == 0 || k == bins - 1 ? 1 : 2;
+    frequencies[k] = (float)(k * sampleRate / segment);
+    psd[k] = (float)((acc[2 * k] + acc[2 * k + 1]) * scale * side);
+  }
+  return segments;
+}
+
+/**
+ * @brief Subtract a known gain curve (in dB) from a power spectrum, e.g. the
+ * calibrated response of the microphone from the spectrum of a recording:
+ * psd[k] /= 10^(gain(frequencies[k]) / 10), with the gain interpolated as in
+ * gainAtFrequency.
+ *
+ * @param frequencies - bins increasing frequencies of psd in Hz
+ * @param psd - bins densities, divided in place
+ * @param bins - length of frequencies and psd
+ * @param knownFrequencies - count increasing frequencies of the curve in Hz
+ * @param knownGains - count gains of the curve in dB
+ * @param count - number of points of the curve
+ */
+inline void subtractGainCurve(const float *frequencies, float *psd, long bins,
+                              const float *knownFrequencies,
+                              const float *knownGains, long count) {
+  long index = 0;
+  if (count < 1) return;
+  for (long k = 0; k < bins; k++) {
+    while (index < count && knownFrequencies[index] < frequencies[k]) index++;
+    const double gain =
+        gainBefore(knownFrequencies, knownGains, count, index, frequencies[k]);
+    psd[k] = (float)(psd[k] * pow(10, -gain / 10));
+  }
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_PSD_HPP_
@@ -0,0 +1,121 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_RESAMPLER_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_RESAMPLER_HPP_
+
+#include <math.h>
+
+#include <vector>
+
+/**
+ * @brief Zeroth order modified Bessel function of the first kind, for the
+ * Kaiser window.
+ */
+inline double besselI0(double x) {
+  double sum = 1, term = 1;
+  for (long k = 1; k < 50; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < 1e-12 * sum) break;
+  }
+  return sum;
+}
+
+/**
+ * @brief Arbitrary-ratio polyphase resampler with a Kaiser windowed-sinc
+ * kernel. The kernel is tabulated at kPhases fractional offsets and linearly
+ * interpolated between them, which is accurate to well below the noise floor
+ * of a recording for any ratio, including the ppm-level ratios of clock
+ * drift.
+ *
+ * When the output is sampled more sparsely than the input (step > 1), the
+ * cutoff drops to 1 / step so the resampled signal does not alias.
+ */
+class SincResampler {
+ public:
+  static const long kPhases = 256;
+
+  /**
+   * @brief Build the kernel table for a given step.
+   *
+   * @param step - input samples per output sample
+   * @param zeroCrossings - sinc zero crossings on each side of the center
+   */
+  explicit SincResampler(double step, long zeroCrossings = 16);
+
+  /**
+   * @brief Number of output samples available from inLength input samples
+   * when the first output sample is taken at input position start.
+   */
+  long outputLength(long inLength, double start) const;
+
+  /**
+   * @brief out[m] = input interpolated at position start + m * step, for m
+   * in [0, outLength). Input samples outside [0, inLength) count as zero.
+   */
+  void process(const float *in, long inLength, double start, float *out,
+               long outLength) const;
+
+ private:
+  double step;
+  long halfTaps;            // taps on each side of the interpolation point
+  std::vector<float> table;  // (kPhases + 1) rows of 2 * halfTaps taps
+};
+
+inline SincResampler::SincResampler(double step, long zeroCrossings)
+    : step(step) {
+  const double cutoff = step > 1 ? 0.97 / step : 0.97;
+  const double beta = 8.6;  // about -90 dB side lobes
+  halfTaps = (long)ceil(zeroCrossings / cutoff);
+  const long taps = 2 * halfTaps;
+  table.resize((kPhases + 1) * taps);
+  for (long p = 0; p <= kPhases; p++) {
+    const double frac = double(p) / kPhases;
+    for (long j = 0; j < taps; j++) {
+      const double t = (j - halfTaps + 1) - frac;  // distance to the tap
+      const double x = t / halfTaps;
+      double h = 0;
+      if (fabs(x) < 1) {
+        const double arg = M_PI * cutoff * t;
+        const double sinc = t == 0 ? 1 : sin(arg) / arg;
+        h = cutoff * sinc * besselI0(beta * sqrt(1 - x * x)) / besselI0(beta);
+      }
+      table[p * taps + j] = (float)h;
+    }
+  }
+}
+
+inline long SincResampler::outputLength(long inLength, double start) const {
+  if (inLength <= 0 || start > inLength - 1) return 0;
+  return (long)floor((inLength - 1 - start) / step) + 1;
+}
+
+inline void SincResampler::process(const float *in, long inLength,
+                                   double start, float *out,
+                                   long outLength) const {
+  const long taps = 2 * halfTaps;
+  for (long m = 0; m < outLength; m++) {
+    const double x = start + m * step;
+    const long i = (long)floor(x);
+    const double phase = (x - i) * kPhases;
+    const long p = (long)phase;
+    const float w = (float)(phase - p);
+    const float *h0 = table.data() + p * taps;
+    const float *h1 = h0 + taps;
+    const long first = i - halfTaps + 1;
+    float sum = 0;
+    if (first >= 0 && first + taps <= inLength) {
+      const float *src = in + first;
+      for (long j = 0; j < taps; j++) {
+        sum += src[j] * (h0[j] + w * (h1[j] - h0[j]));
+      }
+    } else {
+      for (long j = 0; j < taps; j++) {
+        const long k = first + j;
+        if (k < 0 || k >= inLength) continue;
+        sum += in[k] * (h0[j] + w * (h1[j] - h0[j]));
+      }
+    }
+    out[m] = sum;
+  }
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_RESAMPLER_HPP_
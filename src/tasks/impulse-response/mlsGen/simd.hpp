@@ -0,0 +1,155 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_SIMD_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_SIMD_HPP_
+
+#include <stdint.h>
+
+// Pick the widest vector extension the compiler was asked to target. Under
+// emscripten this requires -msimd128, natively -mavx2 (SSE2 is the x86_64
+// baseline). Every kernel has a scalar fallback.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MLSGEN_SIMD_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MLSGEN_SIMD_SSE2 1
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define MLSGEN_SIMD_WASM 1
+#endif
+
+/**
+ * @brief Expand n bits of a packed (LSB first) bitset into a +-1 signal,
+ * mapping 0 to +1 and 1 to -1 (the same as -2 * bit + 1).
+ */
+inline void expandBitsToSigns(const uint64_t *bits, float *out, long n) {
+  long i = 0;
+#if defined(MLSGEN_SIMD_AVX2)
+  const __m256i select = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  for (; i + 8 <= n; i += 8) {
+    const int byte = (int)((bits[i >> 6] >> (i & 63)) & 0xff);
+    const __m256i set = _mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_set1_epi32(byte), select), select);
+    const __m256 flip = _mm256_and_ps(_mm256_castsi256_ps(set), sign);
+    _mm256_storeu_ps(out + i, _mm256_or_ps(one, flip));
+  }
+#elif defined(MLSGEN_SIMD_SSE2)
+  const __m128i select = _mm_setr_epi32(1, 2, 4, 8);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  for (; i + 4 <= n; i += 4) {
+    const int nibble = (int)((bits[i >> 6] >> (i & 63)) & 0xf);
+    const __m128i set = _mm_cmpeq_epi32(
+        _mm_and_si128(_mm_set1_epi32(nibble), select), select);
+    const __m128 flip = _mm_and_ps(_mm_castsi128_ps(set), sign);
+    _mm_storeu_ps(out + i, _mm_or_ps(one, flip));
+  }
+#elif defined(MLSGEN_SIMD_WASM)
+  const v128_t select = wasm_i32x4_make(1, 2, 4, 8);
+  const v128_t one = wasm_f32x4_splat(1.0f);
+  const v128_t sign = wasm_f32x4_splat(-0.0f);
+  for (; i + 4 <= n; i += 4) {
+    const int nibble = (int)((bits[i >> 6] >> (i & 63)) & 0xf);
+    const v128_t set =
+        wasm_i32x4_eq(wasm_v128_and(wasm_i32x4_splat(nibble), select), select);
+    wasm_v128_store(out + i, wasm_v128_or(one, wasm_v128_and(set, sign)));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = 1.0f - 2.0f * (float)((bits[i >> 6] >> (i & 63)) & 1);
+  }
+}
+
+/**
+ * @brief Minimal packed vector wrapper used by the transform kernels. Vec<T>
+ * exposes the native register type, its lane count, unaligned load/store and
+ * lane-wise arithmetic; the primary template is the scalar fallback.
+ */
+template <typename T>
+struct Vec {
+  typedef T type;
+  static const int width = 1;
+  static inline type load(const T *p) { return *p; }
+  static inline void store(T *p, type v) { *p = v; }
+  static inline type add(type a, type b) { return a + b; }
+  static inline type sub(type a, type b) { return a - b; }
+  static inline type splat(T a) { return a; }
+  static inline type mul(type a, type b) { return a * b; }
+};
+
+#if defined(MLSGEN_SIMD_AVX2)
+template <>
+struct Vec<float> {
+  typedef __m256 type;
+  static const int width = 8;
+  static inline type load(const float *p) { return _mm256_loadu_ps(p); }
+  static inline void store(float *p, type v) { _mm256_storeu_ps(p, v); }
+  static inline type add(type a, type b) { return _mm256_add_ps(a, b); }
+  static inline type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+  static inline type splat(float a) { return _mm256_set1_ps(a); }
+  static inline type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+};
+
+template <>
+struct Vec<double> {
+  typedef __m256d type;
+  static const int width = 4;
+  static inline type load(const double *p) { return _mm256_loadu_pd(p); }
+  static inline void store(double *p, type v) { _mm256_storeu_pd(p, v); }
+  static inline type add(type a, type b) { return _mm256_add_pd(a, b); }
+  static inline type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+  static inline type splat(double a) { return _mm256_set1_pd(a); }
+  static inline type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+};
+#elif defined(MLSGEN_SIMD_SSE2)
+template <>
+struct Vec<float> {
+  typedef __m128 type;
+  static const int width = 4;
+  static inline type load(const float *p) { return _mm_loadu_ps(p); }
+  static inline void store(float *p, type v) { _mm_storeu_ps(p, v); }
+  static inline type add(type a, type b) { return _mm_add_ps(a, b); }
+  static inline type sub(type a, type b) { return _mm_sub_ps(a, b); }
+  static inline type splat(float a) { return _mm_set1_ps(a); }
+  static inline type mul(type a, type b) { return _mm_mul_ps(a, b); }
+};
+
+template <>
+struct Vec<double> {
+  typedef __m128d type;
+  static const int width = 2;
+  static inline type load(const double *p) { return _mm_loadu_pd(p); }
+  static inline void store(double *p, type v) { _mm_storeu_pd(p, v); }
+  static inline type add(type a, type b) { return _mm_add_pd(a, b); }
+  static inline type sub(type a, type b) { return _mm_sub_pd(a, b); }
+  static inline type splat(double a) { return _mm_set1_pd(a); }
+  static inline type mul(type a, type b) { return _mm_mul_pd(a, b); }
+};
+#elif defined(MLSGEN_SIMD_WASM)
+template <>
+struct Vec<float> {
+  typedef v128_t type;
+  static const int width = 4;
+  static inline type load(const float *p) { return wasm_v128_load(p); }
+  static inline void store(float *p, type v) { wasm_v128_store(p, v); }
+  static inline type add(type a, type b) { return wasm_f32x4_add(a, b); }
+  static inline type sub(type a, type b) { return wasm_f32x4_sub(a, b); }
+  static inline type splat(float a) { return wasm_f32x4_splat(a); }
+  static inline type mul(type a, type b) { return wasm_f32x4_mul(a, b); }
+};
+
+template <>
+struct Vec<double> {
+  typedef v128_t type;
+  static const int width = 2;
+  static inline type load(const double *p) { return wasm_v128_load(p); }
+  static inline void store(double *p, type v) { wasm_v128_store(p, v); }
+  static inline type add(type a, type b) { return wasm_f64x2_add(a, b); }
+  static inline type sub(type a, type b) { return wasm_f64x2_sub(a, b); }
+  static inline type splat(double a) { return wasm_f64x2_splat(a); }
+  static inline type mul(type a, type b) { return wasm_f64x2_mul(a, b); }
+};
+#endif
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_SIMD_HPP_
@@ -0,0 +1,236 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_TAGS_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_TAGS_HPP_
+
+#include <stdint.h>
+
+#include "lfsr.hpp"
+
+/**
+ * @brief How the inverse tag permutations of an MLSPlan are stored. The
+ * tags are below 2^N, so 16 bit entries hold them up to order 16 and 32 bit
+ * entries for every supported order. kTagsOnTheFly keeps no tables at all:
+ * the tags are regenerated from the packed MLS while permuting, trading the
+ * random-access table reads for a shift and a few XORs per sample.
+ */
+enum TagStorage {
+  kTagsAuto = 0,      // 16 bit up to order 16, 32 bit up to 20, then none
+  kTagsUint16 = 1,
+  kTagsUint32 = 2,
+  kTagsOnTheFly = 3,
+};
+
+// Highest order kTagsAuto builds tables for; two 32 bit tables take
+// 2^(N + 3) bytes, 8 MB at order 20 and 128 MB at order 24.
+const long kMaxTableOrder = 20;
+
+/**
+ * @brief The storage actually used for order N: 16 bit tables that cannot
+ * hold the tags become 32 bit ones, and kTagsAuto (or anything unknown) picks
+ * the smallest table up to kMaxTableOrder and no tables above it.
+ */
+inline TagStorage resolveTagStorage(long storage, long N) {
+  if (storage == kTagsOnTheFly || storage == kTagsUint32) {
+    return (TagStorage)storage;
+  }
+  if (storage != kTagsUint16 && N > kMaxTableOrder) return kTagsOnTheFly;
+  return N <= 16 ? kTagsUint16 : kTagsUint32;
+}
+
+/**
+ * @brief Bytes per entry of the tables of a (resolved) storage, 0 without
+ * tables.
+ */
+inline long tagStorageBytes(TagStorage storage) {
+  return storage == kTagsUint16 ? 2 : storage == kTagsUint32 ? 4 : 0;
+}
+
+/**
+ * @brief Fill the entries of tagSInv for positions i in [begin, end) only, so
+ * disjoint ranges can be built in parallel. The window is primed with the
+ * N - 1 samples before begin; tagSInv[0] is left alone.
+ */
+template <typename Index>
+inline void generateTagSInverse(const uint64_t *mls, Index *tagSInv, long N,
+                                long begin, long end) {
+  const long P = (1L << N) - 1;
+  long i, k, window = 0;
+  for (k = begin - N + 1; k < begin; k++) {
+    i = k < 0 ? k + P : k;
+    window = (window >> 1) | (long)((mls[i >> 6] >> (i & 63)) & 1) << (N - 1);
+  }
+  for (i = begin; i < end; i++) {
+    window = (window >> 1) | (long)((mls[i >> 6] >> (i & 63)) & 1) << (N - 1);
+    tagSInv[window] = (Index)i;
+  }
+}
+
+/**
+ * @brief Inverse of the tagS permutation: tagSInv[tagS[i]] = i for every i,
+ * and tagSInv[0] = P (tags are never zero). tagS[i], the permutation of the S
+ * matrix, is the N bit window mls[i], mls[i - 1], ..., mls[i - N + 1]
+ * (indices mod P) read as a binary number with mls[i] as the most significant
+ * bit; consecutive windows overlap in N - 1 bits, so each tag is the previous
+ * one shifted right by one with the new sample or'ed in at the top.
+ *
+ * Lets the permutation of the recording be written as a gather with
+ * sequential stores. Index is any integer type that holds P.
+ */
+template <typename Index>
+inline void generateTagSInverse(const uint64_t *mls, Index *tagSInv, long N) {
+  const long P = (1L << N) - 1;
+  tagSInv[0] = (Index)P;
+  generateTagSInverse(mls, tagSInv, N, 0, P);
+}
+
+/**
+ * @brief Fill the entries of tagLInv for positions i in [begin, end) only,
+ * starting from the N tags tagL[begin], ..., tagL[begin + N - 1] in ring
+ * (which is used as the working ring and overwritten).
+ */
+template <typename Index>
+inline void generateTagLInverse(long *ring, Index *tagLInv, long N, long begin,
+                                long end) {
+  const uint64_t tapMask = kTapMasks[N];
+  long lags[kMaxMlsOrder];
+  long nLags = 0;
+  long i, l, slot = 0;
+  for (l = 0; l < N - 1; l++) {
+    if ((tapMask >> l) & 1) lags[nLags++] = l + 1;
+  }
+  for (i = begin; i < begin + N && i < end; i++) {
+    tagLInv[ring[i - begin]] = (Index)i;
+  }
+  for (; i < end; i++) {
+    // ring[slot] holds tagL[i - N], ring[(slot + L) % N] holds tagL[i - N + L]
+    long tag = ring[slot];
+    for (l = 0; l < nLags; l++) {
+      const long k = slot + lags[l];
+      tag ^= ring[k < N ? k : k - N];
+    }
+    ring[slot] = tag;
+    tagLInv[tag] = (Index)i;
+    if (++slot == N) slot = 0;
+  }
+}
+
+/**
+ * @brief Inverse of the tagL permutation: tagLInv[tagL[i]] = i for every i,
+ * and tagLInv[0] = P. Bit j of tagL[i], the permutation of the L matrix, is
+ * mls[index[j] - i], where index[j] is the column whose tagS is 2^j.
+ *
+ * Every sample of the sequence is a linear (GF(2)) function of the N bit
+ * window at any other position, and tagL[i] is exactly the coefficient vector
+ * mapping the window at k to mls[k - i]. For i < N that is a single bit; past
+ * that, running the feedback recurrence backwards,
+ * mls[k - i] = mls[k - i + N] ^ (mls[k - i + N - L] for every tap lag L < N),
+ * gives tagL[i] as the XOR of a few earlier tags. No search for index[] or
+ * modulo arithmetic is needed, and as the recurrence only looks N tags back
+ * the forward tags are kept in an N entry ring instead of a P-long table.
+ */
+template <typename Index>
+inline void generateTagLInverse(Index *tagLInv, long N) {
+  const long P = (1L << N) - 1;
+  long ring[kMaxMlsOrder];
+  long i;
+  tagLInv[0] = (Index)P;
+  for (i = 0; i < N && i < P; i++) ring[i] = 1L << (N - 1 - i);
+  generateTagLInverse(ring, tagLInv, N, 0, P);
+}
+
+/**
+ * @brief Positions of the N tags that are powers of two, unitTags[j] = i
+ * where tagS[i] = 2^j (that is tagSInv[1 << j]), found with one pass over
+ * the sequence for when there is no tagSInv table to read them from.
+ */
+inline void findUnitTags(const uint64_t *mls, long N, long *unitTags) {
+  const long P = (1L << N) - 1;
+  long i, window = 0;
+  for (i = P - N + 1; i < P; i++) {
+    window = (window >> 1) | (long)((mls[i >> 6] >> (i & 63)) & 1) << (N - 1);
+  }
+  for (i = 0; i < P; i++) {
+    window = (window >> 1) | (long)((mls[i >> 6] >> (i & 63)) & 1) << (N - 1);
+    if ((window & (window - 1)) == 0) {
+      long j = 0;
+      while ((1L << j) != window) j++;
+      unitTags[j] = i;
+    }
+  }
+}
+
+/**
+ * @brief Compute tagL[begin], ..., tagL[begin + N - 1] into ring without
+ * running the recurrence from 0, using bit j of tagL[i] = mls[unitTags[j] - i]
+ * (see findUnitTags). Lets generateTagLInverse start mid-sequence.
+ */
+inline void seekTagLFromUnitTags(const uint64_t *mls, const long *unitTags,
+                                 long N, long begin, long *ring) {
+  const long P = (1L << N) - 1;
+  for (long m = 0; m < N; m++) {
+    long tag = 0;
+    for (long j = 0; j < N; j++) {
+      long k = (unitTags[j] - begin - m) % P;
+      if (k < 0) k += P;
+      tag |= (long)((mls[k >> 6] >> (k & 63)) & 1) << j;
+    }
+    ring[m] = tag;
+  }
+}
+
+/**
+ * @brief seekTagLFromUnitTags with the unit tags read from tagSInv.
+ */
+template <typename Index>
+inline void seekTagL(const uint64_t *mls, const Index *tagSInv, long N,
+                     long begin, long *ring) {
+  long unitTags[kMaxMlsOrder];
+  for (long j = 0; j < N; j++) unitTags[j] = (long)tagSInv[1L << j];
+  seekTagLFromUnitTags(mls, unitTags, N, begin, ring);
+}
+
+/**
+ * @brief Running tagS and tagL, for permuting without tables: next() moves
+ * to the following position of the sequence in a shift and a few XORs.
+ * Positions run from begin up to P - 1; the cursor does not wrap around.
+ */
+struct TagCursor {
+  const uint64_t *mls;
+  long N;
+  long position;  // index i of tagS and tagL below
+  long tagS;      // window of the sequence at position
+  long ring[kMaxMlsOrder];  // tagL[position + k] at (slot + k) % N, k < N
+  long slot;
+  long lags[kMaxMlsOrder];
+  long nLags;
+
+  TagCursor(const uint64_t *mls, const long *unitTags, long N, long begin)
+      : mls(mls), N(N), position(begin), tagS(0), slot(0), nLags(0) {
+    const long P = (1L << N) - 1;
+    for (long l = 0; l < N - 1; l++) {
+      if ((kTapMasks[N] >> l) & 1) lags[nLags++] = l + 1;
+    }
+    for (long k = begin - N + 1; k <= begin; k++) {
+      const long i = k < 0 ? k + P : k;
+      tagS = (tagS >> 1) | (long)((mls[i >> 6] >> (i & 63)) & 1) << (N - 1);
+    }
+    seekTagLFromUnitTags(mls, unitTags, N, begin, ring);
+  }
+
+  long tagL() const { return ring[slot]; }
+
+  inline void next() {
+    position++;
+    const long i = position;
+    tagS = (tagS >> 1) | (long)((mls[i >> 6] >> (i & 63)) & 1) << (N - 1);
+    // ring[slot] held tagL[position - 1]; it becomes tagL[position - 1 + N]
+    long tag = ring[slot];
+    for (long l = 0; l < nLags; l++) {
+      const long k = slot + lags[l];
+      tag ^= ring[k < N ? k : k - N];
+    }
+    ring[slot] = tag;
+    if (++slot == N) slot = 0;
+  }
+};
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_TAGS_HPP_
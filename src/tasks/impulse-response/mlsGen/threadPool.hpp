@@ -0,0 +1,152 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_THREADPOOL_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_THREADPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Small fixed pool of worker threads running one parallel loop at a
+ * time. The calling thread takes part in every loop as thread 0, so a pool of
+ * size 1 has no workers and runs everything inline, in order.
+ *
+ * Natively this uses std::thread. Under emscripten the workers are pthreads,
+ * which needs a build with -pthread (and a cross-origin isolated page for
+ * SharedArrayBuffer); any other WASM build falls back to a single thread.
+ *
+ * Loop bodies must only write memory owned by their index, and must not start
+ * another parallel loop on the same pool.
+ */
+class ThreadPool {
+ public:
+  /**
+   * @brief Start numThreads - 1 workers (none for numThreads <= 1).
+   *
+   * @param numThreads - total number of threads, including the caller
+   */
+  explicit ThreadPool(long numThreads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /**
+   * @brief Number of threads taking part in a loop, including the caller.
+   */
+  long size() const { return numThreads; }
+
+  /**
+   * @brief Call body(index, thread) for every index in [0, count), spread
+   * over the pool, and return once all calls are done. thread is in
+   * [0, size()) and identifies the calling thread, for per-thread scratch.
+   */
+  void run(long count, const std::function<void(long, long)> &body);
+
+ private:
+  long numThreads;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  const std::function<void(long, long)> *task;
+  long taskCount;
+  std::atomic<long> nextIndex;
+  long busyWorkers;
+  long generation;
+  bool stopping;
+
+  void work(long thread);
+  void workerLoop(long thread);
+};
+
+inline ThreadPool::ThreadPool(long numThreads)
+    : numThreads(numThreads < 1 ? 1 : numThreads),
+      task(nullptr),
+      taskCount(0),
+      nextIndex(0),
+      busyWorkers(0),
+      generation(0),
+      stopping(false) {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  ThreadPool::numThreads = 1;  // no pthreads in this WASM build
+#endif
+  for (long t = 1; t < ThreadPool::numThreads; t++) {
+    workers.emplace_back(&ThreadPool::workerLoop, this, t);
+  }
+}
+
+inline ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers) worker.join();
+}
+
+inline void ThreadPool::work(long thread) {
+  long index;
+  while ((index = nextIndex.fetch_add(1)) < taskCount) (*task)(index, thread);
+}
+
+inline void ThreadPool::workerLoop(long thread) {
+  long seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) return;
+      seen = generation;
+    }
+    work(thread);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busyWorkers == 0) finished.notify_one();
+    }
+  }
+}
+
+inline void ThreadPool::run(long count,
+                            const std::function<void(long, long)> &body) {
+  if (workers.empty() || count <= 1) {
+    for (long index = 0; index < count; index++) body(index, 0);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &body;
+    taskCount = count;
+    nextIndex = 0;
+    busyWorkers = (long)workers.size();
+    generation++;
+  }
+  wake.notify_all();
+  work(0);
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&] { return busyWorkers == 0; });
+  task = nullptr;
+}
+
+/**
+ * @brief Run body(index, thread) for every index in [0, count) on the pool,
+ * or inline on the calling thread (thread 0) when pool is null.
+ */
+template <typename Body>
+inline void parallelFor(ThreadPool *pool, long count, const Body &body) {
+  if (pool == nullptr || pool->size() == 1) {
+    for (long index = 0; index < count; index++) body(index, 0L);
+    return;
+  }
+  pool->run(count, body);
+}
+
+/**
+ * @brief Number of threads parallelFor will use with this pool.
+ */
+inline long poolSize(const ThreadPool *pool) {
+  return pool == nullptr ? 1 : pool->size();
+}
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_THREADPOOL_HPP_
@@ -0,0 +1,174 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_WORKARENA_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_WORKARENA_HPP_
+
+#include <stddef.h>
+
+#include <map>
+#include <mutex>
+#include <new>
+
+/**
+ * @brief One 64-byte aligned block of memory that the working arrays of an
+ * MLSGen (or the tables of an MLSPlan) are carved from, each array starting
+ * on a cache line so SIMD loads never straddle one.
+ *
+ * Blocks come from a module-wide pool: a released block is kept for the next
+ * arena of about the same size instead of being freed, so creating and
+ * destroying engines of the same order is a map lookup, and the WASM linear
+ * memory neither fragments nor grows from one calibration to the next. The
+ * pool holds at most kMaxPooledBytes; a block that does not fit is freed at
+ * once, so the arenas of the highest orders are never held idle.
+ */
+class WorkArena {
+ public:
+  static const long kAlignment = 64;
+  static const long kMaxPooledBytes = 16L << 20;  // free blocks kept for reuse
+
+  /**
+   * @brief Bytes taken by count elements of T, rounded up to the alignment;
+   * the size of an arena is the sum over its arrays.
+   */
+  template <typename T>
+  static long bytesFor(long count) {
+    const long bytes = count * (long)sizeof(T);
+    return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  WorkArena() : block(nullptr), capacity(0), used(0) {}
+
+  /**
+   * @brief Arena of at least bytes, from the pool when a block fits.
+   */
+  explicit WorkArena(long bytes) : block(nullptr), capacity(0), used(0) {
+    acquire(bytes);
+  }
+
+  ~WorkArena() { release(); }
+
+  WorkArena(WorkArena &&other) noexcept
+      : block(other.block), capacity(other.capacity), used(other.used) {
+    other.block = nullptr;
+    other.capacity = other.used = 0;
+  }
+
+  WorkArena &operator=(WorkArena &&other) noexcept {
+    if (this != &other) {
+      release();
+      block = other.block;
+      capacity = other.capacity;
+      used = other.used;
+      other.block = nullptr;
+      other.capacity = other.used = 0;
+    }
+    return *this;
+  }
+
+  WorkArena(const WorkArena &) = delete;
+  WorkArena &operator=(const WorkArena &) = delete;
+
+  /**
+   * @brief Next count elements of T, aligned, uninitialized; nullptr when
+   * the arena was sized too small.
+   */
+  template <typename T>
+  T *take(long count) {
+    const long bytes = bytesFor<T>(count);
+    if (block == nullptr || used + bytes > capacity) return nullptr;
+    T *data = reinterpret_cast<T *>(block + used);
+    used += bytes;
+    return data;
+  }
+
+  long size() const { return capacity; }
+
+  /**
+   * @brief Hand the block back to the pool (or free it if the pool has no
+   * room for it). Every array taken from the arena is invalid afterwards.
+   */
+  void release() {
+    if (block == nullptr) return;
+    {
+      std::lock_guard<std::mutex> lock(poolMutex());
+      if (pooled() + capacity <= kMaxPooledBytes) {
+        pool().insert(std::make_pair(capacity, block));
+        pooled() += capacity;
+        block = nullptr;
+      }
+    }
+    if (block != nullptr) freeBlock(block);
+    block = nullptr;
+    capacity = used = 0;
+  }
+
+  /**
+   * @brief Free every pooled block.
+   *
+   * @return long - number of blocks freed
+   */
+  static long releaseUnused() {
+    std::lock_guard<std::mutex> lock(poolMutex());
+    const long released = (long)pool().size();
+    for (auto &entry : pool()) freeBlock(entry.second);
+    pool().clear();
+    pooled() = 0;
+    return released;
+  }
+
+  /**
+   * @brief Bytes of the free blocks held in the pool.
+   */
+  static long pooledBytes() {
+    std::lock_guard<std::mutex> lock(poolMutex());
+    return pooled();
+  }
+
+ private:
+  char *block;
+  long capacity;
+  long used;
+
+  void acquire(long bytes) {
+    bytes = bytes > kAlignment ? bytesFor<char>(bytes) : kAlignment;
+    {
+      // smallest pooled block that fits, if it is not more than twice as big
+      std::lock_guard<std::mutex> lock(poolMutex());
+      auto it = pool().lower_bound(bytes);
+      if (it != pool().end() && it->first <= 2 * bytes) {
+        capacity = it->first;
+        block = it->second;
+        pooled() -= capacity;
+        pool().erase(it);
+      }
+    }
+    if (block == nullptr) {
+      capacity = bytes;
+      block = static_cast<char *>(
+          ::operator new((size_t)bytes, std::align_val_t(kAlignment)));
+    }
+    used = 0;
+  }
+
+  static void freeBlock(char *data) {
+    ::operator delete(data, std::align_val_t(kAlignment));
+  }
+
+  // Never destroyed: cached plans still hand their blocks back while the
+  // statics are torn down at exit.
+  static std::mutex &poolMutex() {
+    static std::mutex *mutex = new std::mutex;
+    return *mutex;
+  }
+
+  static std::multimap<long, char *> &pool() {
+    static std::multimap<long, char *> *blocks =
+        new std::multimap<long, char *>;
+    return *blocks;
+  }
+
+  static long &pooled() {
+    static long bytes = 0;
+    return bytes;
+  }
+};
+
+#endif  // SPEAKER_CALIBRATION_SRC_TASKS_IMPULSE_RESPONSE_MLSGEN_WORKARENA_HPP_
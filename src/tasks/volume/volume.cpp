@@ -1,3 +1,118 @@
 #include "volume.hpp"
 
-#include <sanitizer/lsan_interface.h>
\ No newline at end of file
+Volume::Volume(long sampleRate, double lCalib)
+    : sampleRate(sampleRate),
+      lCalib(lCalib),
+      windowSum(0),
+      harmonics(MAX_HARMONIC, 0.0),
+      outDbSPL(0),
+      outDbSPL1000(0),
+      thd(0) {}
+
+void Volume::measureHarmonics(const float *signal, long n) {
+  double coeff[MAX_HARMONIC], s1[MAX_HARMONIC], s2[MAX_HARMONIC];
+  long count = 0, h, i;
+
+  if ((long)window.size() != n) {
+    // periodic Hann, so a whole number of cycles leaks nothing
+    window.resize(n);
+    windowSum = 0;
+    for (i = 0; i < n; i++) {
+      window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / n));
+      windowSum += window[i];
+    }
+  }
+  while (count < MAX_HARMONIC &&
+         (count + 1) * TONE_FREQUENCY < sampleRate / 2.0) {
+    coeff[count] = 2 * cos(2 * M_PI * (count + 1) * TONE_FREQUENCY / sampleRate);
+    s1[count] = s2[count] = 0;
+    count++;
+  }
+  // one Goertzel filter per harmonic, fed the same windowed sample
+  for (i = 0; i < n; i++) {
+    const double x = (double)window[i] * signal[i];
+    for (h = 0; h < count; h++) {
+      const double s0 = x + coeff[h] * s1[h] - s2[h];
+      s2[h] = s1[h];
+      s1[h] = s0;
+    }
+  }
+  for (h = 0; h < MAX_HARMONIC; h++) {
+    const double power =
+        h < count ? s1[h] * s1[h] + s2[h] * s2[h] - coeff[h] * s1[h] * s2[h]
+                  : 0;
+    harmonics[h] = windowSum > 0 ? 2 * sqrt(fmax(power, 0)) / windowSum : 0;
+  }
+}
+
+void Volume::analyze(const float *signal, long n) {
+  double energy = 0, distortion = 0;
+  long i, h;
+
+  if (n < 1) throw std::invalid_argument("Volume: empty recording");
+  for (i = 0; i < n; i++) energy += (double)signal[i] * signal[i];
+  measureHarmonics(signal, n);
+  for (h = 1; h < MAX_HARMONIC; h++) distortion += harmonics[h] * harmonics[h];
+
+  outDbSPL = lCalib + 10 * log10(energy / n);
+  // RMS of the fundamental: its amplitude / sqrt(2)
+  outDbSPL1000 = lCalib + 20 * log10(harmonics[0] / M_SQRT2);
+  thd = 100 * sqrt(distortion) / harmonics[0];
+}
+
+void Volume::analyzeCapture(const float *capture, long n) {
+  long start = (long)floor(TARGET_RANGE[0] * sampleRate);
+  long end = (long)floor(TARGET_RANGE[1] * sampleRate);
+  if (end > n) end = n;
+  if (start >= end) start = 0, end = n;  // too short: all of it
+  analyze(capture + start, end - start);
+}
+
+#ifdef __EMSCRIPTEN__
+using namespace emscripten;
+
+val getVolume(val signal, long sampleRate, double lCalib) {
+  const std::vector<float> x = convertJSArrayToNumberVector<float>(signal);
+  Volume volume(sampleRate, lCalib);
+  volume.analyze(x.data(), (long)x.size());
+  val levels = val::object();
+  levels.set("outDbSPL", volume.getOutDbSPL());
+  levels.set("outDbSPL1000", volume.getOutDbSPL1000());
+  levels.set("thd", volume.getThd());
+  return levels;
+}
+
+val getVolumeParameters(val inDb, val outDbSPL, val warmStart) {
+  const std::vector<double> x = convertJSArrayToNumberVector<double>(inDb);
+  const std::vector<double> y = convertJSArrayToNumberVector<double>(outDbSPL);
+  const long n = (long)std::min(x.size(), y.size());
+  if (n < 1) {
+    throw std::invalid_argument("getVolumeParameters: no levels to fit");
+  }
+  VolumeParameters previous;
+  const bool warm = !warmStart.isNull() && !warmStart.isUndefined();
+  if (warm) {
+    previous.T = warmStart["T"].as<double>();
+    previous.W = warmStart["W"].as<double>();
+    previous.R = warmStart["R"].as<double>();
+    previous.gainDBSPL = warmStart["gainDBSPL"].as<double>();
+    previous.backgroundDBSPL = warmStart["backgroundDBSPL"].as<double>();
+  }
+  const VolumeParameters fit =
+      fitVolumeParameters(x.data(), y.data(), n, warm ? &previous : nullptr);
+  val parameters = val::object();
+  parameters.set("T", fit.T);
+  parameters.set("W", fit.W);
+  parameters.set("R", fit.R);
+  parameters.set("gainDBSPL", fit.gainDBSPL);
+  parameters.set("backgroundDBSPL", fit.backgroundDBSPL);
+  parameters.set("RMSError", fit.RMSError);
+  return parameters;
+}
+
+// Binding code, linked into the mlsGen module
+EMSCRIPTEN_BINDINGS(volume_module) {
+  function("getVolume", &getVolume);
+  function("getVolumeParameters", &getVolumeParameters);
+};
+#endif
@@ -10,14 +10,77 @@
 
 #include <math.h>
 
+#include <stdexcept>
+#include <vector>
+
+#include "volumeFit.hpp"
+
+/**
+ * @brief Level and distortion of the 1000 Hz calibration tone, the
+ * /task/volume of the Python server: from a recording of the tone it gives
+ * the sound level of the whole recording (outDbSPL), of the 1000 Hz component
+ * alone (outDbSPL1000) and the total harmonic distortion (thd).
+ *
+ * Levels are in dB SPL, lCalib being the level of a recording whose RMS is 1.
+ * The tone and its harmonics are measured by Goertzel filters at their exact
+ * frequencies under a Hann window, all in one pass over the recording.
+ */
 class Volume {
-    private:
-    const long REF_POWER = 2 * pow(10, -10);
-    const long REF_PRESSURE = 2 * pow(10, -5);
-    const long TARGET_RANGE[2] = { 3.5, 4.5 };
-    long sampleRate;
-    long *sineSignal;
-    long *recordedSineSignal;
-}
-
-#endif // SPEAKER_CALIBRATION_SRC_TASKS_VOLUMME_VOLUME_HPP_
\ No newline at end of file
+ public:
+  static constexpr double REF_POWER = 2e-10;    // W, 0 dB of a sound power
+  static constexpr double REF_PRESSURE = 2e-5;  // Pa, 0 dB SPL
+  static constexpr double TARGET_RANGE[2] = {3.5, 4.5};  // s of a capture
+  static constexpr double TONE_FREQUENCY = 1000;         // Hz
+  static constexpr long MAX_HARMONIC = 10;  // highest harmonic in the THD
+
+  /**
+   * @brief Analyzer of recordings at sampleRate.
+   *
+   * @param sampleRate - sampling rate of the recordings in Hz
+   * @param lCalib - dB SPL of a recording with an RMS of 1
+   */
+  Volume(long sampleRate, double lCalib);
+
+  /**
+   * @brief Measure a recording of the tone, as a whole.
+   *
+   * @param signal - n samples at sampleRate
+   * @param n - length of signal, at least 1
+   */
+  void analyze(const float *signal, long n);
+
+  /**
+   * @brief Measure the TARGET_RANGE of a full capture of the tone, where it
+   * has settled (the window volume.js sends to the server).
+   *
+   * @param capture - n samples at sampleRate, from the start of the tone
+   * @param n - length of capture, at least 1
+   */
+  void analyzeCapture(const float *capture, long n);
+
+  double getOutDbSPL() const { return outDbSPL; }
+  double getOutDbSPL1000() const { return outDbSPL1000; }
+  double getThd() const { return thd; }
+
+  /**
+   * @brief Amplitude of the harmonics 1 to MAX_HARMONIC of the tone in the
+   * last recording analyzed, 0 above Nyquist.
+   */
+  const std::vector<double> &getHarmonics() const { return harmonics; }
+
+ private:
+  long sampleRate;
+  double lCalib;
+  std::vector<float> window;  // Hann window of the last length analyzed
+  double windowSum;
+  std::vector<double> harmonics;
+
+  // results
+  double outDbSPL;
+  double outDbSPL1000;
+  double thd;  // percent
+
+  void measureHarmonics(const float *signal, long n);
+};
+
+#endif // SPEAKER_CALIBRATION_SRC_TASKS_VOLUMME_VOLUME_HPP_
@@ -0,0 +1,261 @@
+#ifndef SPEAKER_CALIBRATION_SRC_TASKS_VOLUMME_VOLUMEFIT_HPP_
+#define SPEAKER_CALIBRATION_SRC_TASKS_VOLUMME_VOLUMEFIT_HPP_
+
+#include <math.h>
+
+#include <algorithm>
+
+/**
+ * @brief Parameters of a soft-knee sound level model of a speaker, fitted to
+ * the sweep the volume-parameters task of the Python server fits. The
+ * conventions are this model's own (gainDBSPL is the level of a 0 dB tone,
+ * and no microphone gain is taken out), not the server's, so the two sets of
+ * parameters are not interchangeable.
+ */
+struct VolumeParameters {
+  double T;                // dB, threshold of the compressor
+  double W;                // dB, width of its soft knee
+  double R;                // compression ratio above the knee, at least 1
+  double gainDBSPL;        // dB SPL of a 0 dB digital tone below the knee
+  double backgroundDBSPL;  // dB SPL of the background noise
+  double RMSError;         // dB, RMS residual of the fit
+};
+
+const double kMaxCompressionRatio = 100;
+const long kMaxFitIterations = 200;
+
+/**
+ * @brief Output level in dB of a soft-knee compressor for an input level
+ * inDb: unchanged below the knee, T + (inDb - T) / R above it, and a
+ * quadratic blend across the knee of width W centered on T.
+ *
+ * @param dT, dW, dR - if not null, the derivatives by T, W and R
+ */
+inline double compressorDb(double inDb, double T, double W, double R,
+                           double *dT = nullptr, double *dW = nullptr,
+                           double *dR = nullptr) {
+  const double slope = 1 / R - 1;  // 0 without compression
+  const double u = inDb - T + W / 2;  // depth into the knee
+  double out, gT = 0, gW = 0, gR = 0;
+  if (u <= 0) {
+    out = inDb;
+  } else if (u < W) {
+    out = inDb + slope * u * u / (2 * W);
+    gT = -slope * u / W;
+    gW = slope * (u / (2 * W) - u * u / (2 * W * W));
+    gR = -u * u / (2 * W * R * R);
+  } else {
+    out = T + (inDb - T) / R;
+    gT = -slope;
+    gR = -(inDb - T) / (R * R);
+  }
+  if (dT) *dT = gT;
+  if (dW) *dW = gW;
+  if (dR) *dR = gR;
+  return out;
+}
+
+/**
+ * @brief dB SPL the model predicts for a tone at inDb: the background power
+ * plus the power of the compressed tone,
+ * 10 log10(10^(background / 10) + 10^((gain + compressorDb(inDb)) / 10)).
+ *
+ * @param gradient - if not null, the 5 derivatives by T, W, R, gainDBSPL
+ * and backgroundDBSPL
+ */
+inline double soundLevelModelDb(double inDb, const VolumeParameters &p,
+                                double *gradient = nullptr) {
+  double dT, dW, dR;
+  const double compressed = compressorDb(inDb, p.T, p.W, p.R, &dT, &dW, &dR);
+  const double tone = p.gainDBSPL + compressed;
+  // powers relative to the larger one, so neither overflows
+  const double top = std::max(tone, p.backgroundDBSPL);
+  const double toneShare = pow(10, (tone - top) / 10);
+  const double backgroundShare = pow(10, (p.backgroundDBSPL - top) / 10);
+  const double total = toneShare + backgroundShare;
+  if (gradient) {
+    const double toneWeight = toneShare / total;
+    gradient[0] = toneWeight * dT;
+    gradient[1] = toneWeight * dW;
+    gradient[2] = toneWeight * dR;
+    gradient[3] = toneWeight;
+    gradient[4] = backgroundShare / total;
+  }
+  return top + 10 * log10(total);
+}
+
+/**
+ * @brief Solve the kSize linear equations A x = b in place by Gaussian
+ * elimination with partial pivoting.
+ *
+ * @return bool - false if A is singular
+ */
+template <long kSize>
+bool solveLinear(double (&A)[kSize][kSize], double (&b)[kSize]) {
+  long i, j, k;
+  for (k = 0; k < kSize; k++) {
+    long pivot = k;
+    for (i = k + 1; i < kSize; i++) {
+      if (fabs(A[i][k]) > fabs(A[pivot][k])) pivot = i;
+    }
+    if (A[pivot][k] == 0) return false;
+    for (j = 0; j < kSize; j++) std::swap(A[k][j], A[pivot][j]);
+    std::swap(b[k], b[pivot]);
+    for (i = k + 1; i < kSize; i++) {
+      const double f = A[i][k] / A[k][k];
+      for (j = k; j < kSize; j++) A[i][j] -= f * A[k][j];
+      b[i] -= f * b[k];
+    }
+  }
+  for (k = kSize - 1; k >= 0; k--) {
+    for (j = k + 1; j < kSize; j++) b[k] -= A[k][j] * b[j];
+    b[k] /= A[k][k];
+  }
+  return true;
+}
+
+/**
+ * @brief Levenberg-Marquardt minimization of the sum of squared residuals of
+ * a model with kParams parameters over n points.
+ *
+ * model.residual(i, params, gradient) returns residual i and writes its
+ * kParams derivatives; model.constrain(params) moves a trial step back into
+ * the feasible set. The damping scales the diagonal of J'J (Marquardt), so
+ * parameters of very different scales converge alike.
+ *
+ * @param params - kParams starting values, the minimum on return
+ * @return double - sum of squared residuals at params
+ */
+template <long kParams, typename Model>
+double levenbergMarquardt(const Model &model, long n, double *params,
+                          long maxIterations) {
+  double gradient[kParams], trial[kParams];
+  double lambda = 1e-3;
+  long i, j, k;
+
+  const auto cost = [&](const double *p) {
+    double sum = 0;
+    for (long i = 0; i < n; i++) {
+      const double r = model.residual(i, p, gradient);
+      sum += r * r;
+    }
+    return sum;
+  };
+  double current = cost(params);
+  for (long iteration = 0; iteration < maxIterations; iteration++) {
+    // normal equations J'J d = -J'r at params
+    double JtJ[kParams][kParams] = {}, Jtr[kParams] = {};
+    for (i = 0; i < n; i++) {
+      const double r = model.residual(i, params, gradient);
+      for (j = 0; j < kParams; j++) {
+        Jtr[j] -= gradient[j] * r;
+        for (k = 0; k <= j; k++) JtJ[j][k] += gradient[j] * gradient[k];
+      }
+    }
+    for (j = 0; j < kParams; j++) {
+      for (k = j + 1; k < kParams; k++) JtJ[j][k] = JtJ[k][j];
+    }
+    bool improved = false;
+    while (!improved && lambda < 1e12) {
+      double A[kParams][kParams], step[kParams];
+      for (j = 0; j < kParams; j++) {
+        for (k = 0; k < kParams; k++) A[j][k] = JtJ[j][k];
+        A[j][j] += lambda * (JtJ[j][j] > 0 ? JtJ[j][j] : 1);
+        step[j] = Jtr[j];
+      }
+      if (solveLinear(A, step)) {
+        for (j = 0; j < kParams; j++) trial[j] = params[j] + step[j];
+        model.constrain(trial);
+        const double next = cost(trial);
+        if (next < current) {
+          improved = true;
+          const bool converged = current - next <= 1e-12 * (current + 1e-30);
+          std::copy(trial, trial + kParams, params);
+          current = next;
+          lambda = std::max(lambda / 10, 1e-12);
+          if (converged) return current;
+        }
+      }
+      if (!improved) lambda *= 10;
+    }
+    if (!improved) break;  // no step downhill: at the minimum
+  }
+  return current;
+}
+
+/**
+ * @brief Least squares of soundLevelModelDb over the sweep of a calibration.
+ */
+struct VolumeModel {
+  const double *inDb;
+  const double *outDbSPL;
+
+  double residual(long i, const double *p, double *gradient) const {
+    const VolumeParameters parameters = {p[0], p[1], p[2], p[3], p[4], 0};
+    return soundLevelModelDb(inDb[i], parameters, gradient) - outDbSPL[i];
+  }
+
+  void constrain(double *p) const {
+    p[1] = std::max(p[1], 0.0);
+    p[2] = std::min(std::max(p[2], 1.0), kMaxCompressionRatio);
+  }
+};
+
+/**
+ * @brief Fit the speaker's sound level model to the levels of a calibration
+ * sweep: outDbSPL[i] measured for a 1000 Hz tone at inDb[i] (dB re full
+ * scale).
+ *
+ * The fit starts from the parameters of the previous device when given, and
+ * from a few thresholds across the sweep, and keeps the best minimum. The
+ * cold starts take the gain from the quietest tones and the background from
+ * 10 dB under the quietest level.
+ *
+ * @param inDb - n digital levels in dB
+ * @param outDbSPL - n measured levels in dB SPL
+ * @param n - number of levels, at least 1
+ * @param warmStart - previous parameters to start from, or null
+ */
+inline VolumeParameters fitVolumeParameters(const double *inDb,
+                                            const double *outDbSPL, long n,
+                                            const VolumeParameters *warmStart) {
+  const VolumeModel model = {inDb, outDbSPL};
+  double low = inDb[0], high = inDb[0], quietest = outDbSPL[0];
+  double gain = outDbSPL[0] - inDb[0];
+  long i, s;
+
+  for (i = 1; i < n; i++) {
+    if (inDb[i] < low) low = inDb[i], gain = outDbSPL[i] - inDb[i];
+    high = std::max(high, inDb[i]);
+    quietest = std::min(quietest, outDbSPL[i]);
+  }
+  const long coldStarts = 4;
+  double candidates[coldStarts + 1][5];
+  long count = 0;
+  if (warmStart) {
+    const VolumeParameters &w = *warmStart;
+    const double p[5] = {w.T, w.W, w.R, w.gainDBSPL, w.backgroundDBSPL};
+    std::copy(p, p + 5, candidates[count++]);
+  }
+  for (s = 0; s < coldStarts; s++) {
+    // thresholds spread over the top of the sweep, a mild knee and ratio
+    const double T = high - (high - low) * s / (2.0 * coldStarts);
+    const double p[5] = {T, 10, 2, gain, quietest - 10};
+    std::copy(p, p + 5, candidates[count++]);
+  }
+
+  double best[5], bestCost = INFINITY;
+  std::copy(candidates[0], candidates[0] + 5, best);  // if every fit is NaN
+  for (s = 0; s < count; s++) {
+    model.constrain(candidates[s]);
+    const double c =
+        levenbergMarquardt<5>(model, n, candidates[s], kMaxFitIterations);
+    if (c < bestCost) {
+      bestCost = c;
+      std::copy(candidates[s], candidates[s] + 5, best);
+    }
+  }
+  return {best[0], best[1], best[2], best[3], best[4], sqrt(bestCost / n)};
+}
+
+#endif // SPEAKER_CALIBRATION_SRC_TASKS_VOLUMME_VOLUMEFIT_HPP_